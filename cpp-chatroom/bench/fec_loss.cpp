@@ -0,0 +1,202 @@
+/**
+ * @brief 分片纠错的丢包回环测试
+ *
+ * 把一帧按推流端的方式拆分并加上校验分片，逐包序列化后按丢包率随机丢弃，
+ * 剩下的包按接收端的方式解析、重组，组内只缺一个分片时用校验分片恢复。
+ * 输出各丢包率下不靠纠错和靠纠错能完整收到的帧比例，用于选择校验组大小。
+ *
+ * 用法：fec_loss [JPEG文件] [每组数据分片数] [每个丢包率的帧数]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "video/VideoFrame.h"
+
+namespace
+{
+
+const double kLossRates[] = {0.0, 0.01, 0.02, 0.05, 0.10, 0.15, 0.20};
+
+struct LossResult {
+    int framesIntact = 0;       // 数据分片一个不缺
+    int framesRecovered = 0;    // 加上校验分片恢复后收齐
+    int framesCorrupt = 0;      // 收齐但与原帧不一致，应始终为0
+    int chunksRecovered = 0;
+};
+
+std::vector<uint8_t> loadFrame(const char* path)
+{
+    std::vector<uint8_t> frame;
+    if (path) {
+        std::ifstream in(path, std::ios::binary);
+        frame.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return frame;
+    }
+
+    // 没有给文件时用50KB随机数据，与摄像头的一帧JPEG大小相当
+    std::mt19937 rng(1);
+    frame.resize(50 * 1024);
+    for (auto& b : frame) {
+        b = static_cast<uint8_t>(rng());
+    }
+    return frame;
+}
+
+// 接收一帧：解析收到的包，按分片索引放好，再逐组尝试恢复
+void receiveFrame(const std::vector<std::vector<uint8_t>>& packets,
+                  const std::vector<uint8_t>& frame, LossResult& result)
+{
+    std::vector<std::vector<uint8_t>> chunks;
+    std::vector<std::vector<uint8_t>> parity;
+    std::vector<bool> present;
+    size_t groupSize = 0;
+
+    for (const auto& packet : packets) {
+        VideoChunkInfo info;
+        if (!parseChunk(packet.data(), packet.size(), info)) {
+            continue;
+        }
+        const size_t total = info.header.totalChunks;
+        if (chunks.empty()) {
+            chunks.resize(total);
+            present.assign(total, false);
+        }
+        const uint8_t* payload = packet.data() + info.headerSize;
+        const size_t index = info.header.chunkIndex;
+        if (index < total) {
+            chunks[index].assign(payload, payload + info.header.payloadSize);
+            present[index] = true;
+            continue;
+        }
+
+        VideoParityHeader parityHeader;
+        std::memcpy(&parityHeader, payload, sizeof(parityHeader));
+        groupSize = parityHeader.groupSize;
+        const size_t group = index - total;
+        if (parity.size() <= group) {
+            parity.resize(group + 1);
+        }
+        parity[group].assign(payload, payload + info.header.payloadSize);
+    }
+
+    if (chunks.empty()) {
+        return;
+    }
+
+    size_t missingCount = 0;
+    for (bool has : present) {
+        missingCount += has ? 0 : 1;
+    }
+    if (missingCount == 0) {
+        ++result.framesIntact;
+    }
+
+    std::vector<uint8_t> recovered;
+    for (size_t group = 0; groupSize > 0 && group < parity.size(); ++group) {
+        if (parity[group].empty()) {
+            continue;
+        }
+        const size_t first = group * groupSize;
+        const size_t last = std::min(first + groupSize, chunks.size());
+        size_t missing = last;
+        int missingInGroup = 0;
+        std::vector<std::pair<const uint8_t*, size_t>> others;
+        for (size_t i = first; i < last; ++i) {
+            if (present[i]) {
+                others.emplace_back(chunks[i].data(), chunks[i].size());
+            } else {
+                missing = i;
+                ++missingInGroup;
+            }
+        }
+        if (missingInGroup != 1) {
+            continue;
+        }
+        if (recoverChunkFromParity(parity[group].data(), parity[group].size(),
+                                   others, missing, chunks.size(), recovered)) {
+            chunks[missing] = recovered;
+            present[missing] = true;
+            ++result.chunksRecovered;
+        }
+    }
+
+    std::vector<uint8_t> assembled;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (!present[i]) {
+            return;
+        }
+        assembled.insert(assembled.end(), chunks[i].begin(), chunks[i].end());
+    }
+    if (assembled == frame) {
+        ++result.framesRecovered;
+    } else {
+        ++result.framesCorrupt;
+    }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const std::vector<uint8_t> frame = loadFrame(argc > 1 ? argv[1] : nullptr);
+    const size_t groupSize = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10;
+    const int frames = argc > 3 ? std::atoi(argv[3]) : 1000;
+    if (frame.empty() || frames <= 0) {
+        std::fprintf(stderr, "用法: %s [JPEG文件] [每组数据分片数] [每个丢包率的帧数]\n", argv[0]);
+        return 1;
+    }
+
+    // 与推流端相同：启用纠错时给校验分片的载荷头留出空间
+    const size_t maxChunkSize = groupSize > 0
+        ? VIDEO_MAX_CHUNK_SIZE - sizeof(VideoParityHeader)
+        : VIDEO_MAX_CHUNK_SIZE;
+
+    VideoFrameMeta meta;
+    std::vector<VideoChunkView> views;
+    std::vector<uint8_t> parity;
+    meta.frameId = 0;
+    const size_t dataChunks = splitFrameToChunkViews(meta, frame.data(), frame.size(), views, maxChunkSize);
+    const size_t parityChunks = appendParityChunks(views, frame.size(), groupSize, parity);
+    if (dataChunks == 0) {
+        std::fprintf(stderr, "帧分包失败\n");
+        return 1;
+    }
+
+    std::printf("帧 %zu 字节，%zu 个数据分片，%zu 个校验分片（每组 %zu 个，冗余 %.1f%%），每个丢包率 %d 帧\n",
+                frame.size(), dataChunks, parityChunks, groupSize,
+                100.0 * parityChunks / dataChunks, frames);
+    std::printf("%8s %12s %12s %12s %8s\n", "丢包率", "无纠错收齐", "纠错后收齐", "恢复分片", "错误");
+
+    std::mt19937 rng(42);
+    std::vector<std::vector<uint8_t>> packets;
+    for (double lossRate : kLossRates) {
+        std::bernoulli_distribution drop(lossRate);
+        LossResult result;
+        for (int i = 0; i < frames; ++i) {
+            packets.clear();
+            for (const auto& view : views) {
+                if (drop(rng)) {
+                    continue;
+                }
+                std::vector<uint8_t> packet(view.header.headerSize + view.payloadSize);
+                std::memcpy(packet.data(), &view.header, view.header.headerSize);
+                std::memcpy(packet.data() + view.header.headerSize, view.payload, view.payloadSize);
+                packets.push_back(std::move(packet));
+            }
+            receiveFrame(packets, frame, result);
+        }
+        std::printf("%7.0f%% %11.1f%% %11.1f%% %12d %8d\n",
+                    lossRate * 100,
+                    100.0 * result.framesIntact / frames,
+                    100.0 * result.framesRecovered / frames,
+                    result.chunksRecovered, result.framesCorrupt);
+    }
+    return 0;
+}
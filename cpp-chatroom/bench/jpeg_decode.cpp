@@ -0,0 +1,109 @@
+/**
+ * @brief 接收端JPEG解码的性能对比
+ *
+ * 同一幅JPEG按几种显示尺寸反复解码，比较每帧耗时：
+ *   reader  QImageReader + setScaledSize，改动前的做法
+ *   decoder JpegDecoder，有libjpeg-turbo时在DCT域缩小并复用输出缓冲
+ * 没有libjpeg-turbo时JpegDecoder本身也用QImageReader，两列结果应接近。
+ *
+ * 用法：jpeg_decode <JPEG文件> [每种尺寸的次数]，例如 jpeg_decode test.jpeg
+ */
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImageReader>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "video/JpegDecoder.h"
+
+namespace
+{
+
+// 原尺寸，以及播放窗口的常见大小
+const QSize kTargets[] = {QSize(), QSize(1280, 720), QSize(640, 360), QSize(320, 180)};
+
+QImage decodeWithReader(const QByteArray& jpeg, const QSize& target)
+{
+    QByteArray data = QByteArray::fromRawData(jpeg.constData(), jpeg.size());
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    QImageReader reader(&buffer, "JPEG");
+    const QSize original = reader.size();
+    if (original.isValid() && !target.isEmpty()
+        && (original.width() > target.width() || original.height() > target.height())) {
+        reader.setScaledSize(original.scaled(target, Qt::KeepAspectRatio));
+    }
+    return reader.read();
+}
+
+QString sizeName(const QSize& size)
+{
+    return size.isEmpty() ? QStringLiteral("原尺寸") : QStringLiteral("%1x%2").arg(size.width()).arg(size.height());
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);   // 只为加载图片插件，不需要显示
+
+    if (argc < 2) {
+        std::fprintf(stderr, "用法: %s <JPEG文件> [每种尺寸的次数]\n", argv[0]);
+        return 1;
+    }
+    QFile file(QString::fromLocal8Bit(argv[1]));
+    if (!file.open(QIODevice::ReadOnly)) {
+        std::fprintf(stderr, "无法打开 %s\n", argv[1]);
+        return 1;
+    }
+    const QByteArray jpeg = file.readAll();
+    const int iterations = argc > 2 ? std::atoi(argv[2]) : 200;
+    if (iterations <= 0) {
+        return 1;
+    }
+
+#ifdef HAVE_TURBOJPEG
+    std::printf("JpegDecoder使用libjpeg-turbo\n");
+#else
+    std::printf("未找到libjpeg-turbo，JpegDecoder使用QImageReader\n");
+#endif
+    std::printf("%-10s %-12s %12s %12s\n", "显示尺寸", "解码结果", "reader", "decoder");
+
+    JpegDecoder decoder;
+    const auto* data = reinterpret_cast<const uint8_t*>(jpeg.constData());
+    const size_t size = static_cast<size_t>(jpeg.size());
+    QElapsedTimer timer;
+
+    for (const QSize& target : kTargets) {
+        QImage image;
+
+        timer.start();
+        for (int i = 0; i < iterations; ++i) {
+            image = decodeWithReader(jpeg, target);
+        }
+        const double readerUs = timer.nsecsElapsed() / 1000.0 / iterations;
+
+        timer.start();
+        for (int i = 0; i < iterations; ++i) {
+            // 与接收端一样，先放掉上一帧的引用，解码器才能复用缓冲
+            image = QImage();
+            image = decoder.decode(data, size, target);
+        }
+        const double decoderUs = timer.nsecsElapsed() / 1000.0 / iterations;
+
+        if (image.isNull()) {
+            std::fprintf(stderr, "解码失败\n");
+            return 1;
+        }
+        std::printf("%-10s %-12s %9.0f us %9.0f us\n",
+                    qPrintable(sizeName(target)), qPrintable(sizeName(image.size())),
+                    readerUs, decoderUs);
+    }
+    return 0;
+}
@@ -0,0 +1,187 @@
+/**
+ * @brief 推流发送路径的性能对比
+ *
+ * 同一帧用三种方式发往本机回环地址，比较每帧耗时：
+ *   alloc   每个分片分配一个v1包（splitFrameToChunks）再逐个writeDatagram，改动前的做法
+ *   reuse   分片描述 + 复用的包缓冲逐个writeDatagram，推流端没有sendmmsg时的退路
+ *   gather  分片描述 + sendmmsg，包头和载荷以iovec拼接，不复制载荷
+ * 三种方式都用v1分片头，包数和包长相同，只比较发送方式。接收端只绑定不读取，测的是发送端的开销。
+ *
+ * 用法：send_path [JPEG文件] [帧数]
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHostAddress>
+#include <QUdpSocket>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "video/VideoFrame.h"
+
+namespace
+{
+
+constexpr size_t kSendBatch = 64;   // 与VideoStreamer相同
+
+struct Target {
+    QHostAddress address;
+    quint16 port = 0;
+    sockaddr_in sockaddr;
+};
+
+std::vector<uint8_t> loadFrame(const char* path)
+{
+    if (path) {
+        QFile file(QString::fromLocal8Bit(path));
+        if (!file.open(QIODevice::ReadOnly)) {
+            return {};
+        }
+        const QByteArray data = file.readAll();
+        return std::vector<uint8_t>(data.begin(), data.end());
+    }
+    // 没有给文件时用50KB数据，与摄像头的一帧JPEG大小相当
+    std::vector<uint8_t> frame(50 * 1024);
+    for (size_t i = 0; i < frame.size(); ++i) {
+        frame[i] = static_cast<uint8_t>(i * 131);
+    }
+    return frame;
+}
+
+void sendAlloc(QUdpSocket& socket, const Target& target, uint32_t frameId, const std::vector<uint8_t>& frame)
+{
+    const auto chunks = splitFrameToChunks(frameId, frame, VIDEO_MAX_CHUNK_SIZE);
+    for (const auto& chunk : chunks) {
+        socket.writeDatagram(reinterpret_cast<const char*>(chunk.data()),
+                             static_cast<qint64>(chunk.size()), target.address, target.port);
+    }
+}
+
+void sendReuse(QUdpSocket& socket, const Target& target, const std::vector<VideoChunkView>& views,
+               std::vector<uint8_t>& datagram)
+{
+    for (const VideoChunkView& view : views) {
+        const size_t headerSize = view.header.headerSize;
+        datagram.resize(headerSize + view.payloadSize);
+        std::memcpy(datagram.data(), &view.header, headerSize);
+        std::memcpy(datagram.data() + headerSize, view.payload, view.payloadSize);
+        socket.writeDatagram(reinterpret_cast<const char*>(datagram.data()),
+                             static_cast<qint64>(datagram.size()), target.address, target.port);
+    }
+}
+
+void sendGather(int fd, const Target& target, const std::vector<VideoChunkView>& views)
+{
+    mmsghdr msgs[kSendBatch];
+    iovec iovs[kSendBatch][2];
+
+    size_t next = 0;
+    while (next < views.size()) {
+        const size_t batch = std::min(kSendBatch, views.size() - next);
+        for (size_t i = 0; i < batch; ++i) {
+            const VideoChunkView& view = views[next + i];
+            iovs[i][0].iov_base = const_cast<VideoChunkHeaderV2*>(&view.header);
+            iovs[i][0].iov_len = view.header.headerSize;
+            iovs[i][1].iov_base = const_cast<uint8_t*>(view.payload);
+            iovs[i][1].iov_len = view.payloadSize;
+
+            std::memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_name = const_cast<sockaddr_in*>(&target.sockaddr);
+            msgs[i].msg_hdr.msg_namelen = sizeof(target.sockaddr);
+            msgs[i].msg_hdr.msg_iov = iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        const int ret = ::sendmmsg(fd, msgs, static_cast<unsigned int>(batch), 0);
+        if (ret > 0) {
+            next += static_cast<size_t>(ret);
+        } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            std::fprintf(stderr, "sendmmsg失败: %s\n", std::strerror(errno));
+            return;
+        }
+    }
+}
+
+void report(const char* name, qint64 elapsedNs, int frames, size_t chunks)
+{
+    std::printf("%-8s %10.1f us/帧 %8.2f us/分片\n", name,
+                elapsedNs / 1000.0 / frames, elapsedNs / 1000.0 / frames / chunks);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const std::vector<uint8_t> frame = loadFrame(argc > 1 ? argv[1] : nullptr);
+    const int frames = argc > 2 ? std::atoi(argv[2]) : 2000;
+    if (frame.empty() || frames <= 0) {
+        std::fprintf(stderr, "用法: %s [JPEG文件] [帧数]\n", argv[0]);
+        return 1;
+    }
+
+    QUdpSocket receiver;
+    if (!receiver.bind(QHostAddress::LocalHost, 0)) {
+        std::fprintf(stderr, "绑定接收端失败: %s\n", qPrintable(receiver.errorString()));
+        return 1;
+    }
+    QUdpSocket sender;
+    sender.bind(QHostAddress::LocalHost, 0);
+    sender.setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, 4 * 1024 * 1024);
+
+    Target target;
+    target.address = QHostAddress::LocalHost;
+    target.port = receiver.localPort();
+    std::memset(&target.sockaddr, 0, sizeof(target.sockaddr));
+    target.sockaddr.sin_family = AF_INET;
+    target.sockaddr.sin_port = htons(target.port);
+    target.sockaddr.sin_addr.s_addr = htonl(target.address.toIPv4Address());
+
+    VideoFrameMeta meta;
+    std::vector<VideoChunkView> views;
+    const size_t chunks = splitFrameToChunkViews(meta, frame.data(), frame.size(), views, VIDEO_MAX_CHUNK_SIZE, 1);
+    if (chunks == 0) {
+        std::fprintf(stderr, "帧分包失败\n");
+        return 1;
+    }
+    std::printf("帧 %zu 字节，%zu 个分片，%d 帧\n", frame.size(), chunks, frames);
+
+    QElapsedTimer timer;
+
+    timer.start();
+    for (int i = 0; i < frames; ++i) {
+        sendAlloc(sender, target, static_cast<uint32_t>(i), frame);
+    }
+    report("alloc", timer.nsecsElapsed(), frames, chunks);
+
+    std::vector<uint8_t> datagram;
+    timer.start();
+    for (int i = 0; i < frames; ++i) {
+        meta.frameId = static_cast<uint32_t>(i);
+        splitFrameToChunkViews(meta, frame.data(), frame.size(), views, VIDEO_MAX_CHUNK_SIZE, 1);
+        sendReuse(sender, target, views, datagram);
+    }
+    report("reuse", timer.nsecsElapsed(), frames, chunks);
+
+    const int fd = static_cast<int>(sender.socketDescriptor());
+    timer.start();
+    for (int i = 0; i < frames; ++i) {
+        meta.frameId = static_cast<uint32_t>(i);
+        splitFrameToChunkViews(meta, frame.data(), frame.size(), views, VIDEO_MAX_CHUNK_SIZE, 1);
+        sendGather(fd, target, views);
+    }
+    report("gather", timer.nsecsElapsed(), frames, chunks);
+    return 0;
+}
@@ -41,7 +41,7 @@ void AsynWait::clearWaitPack(IdType packetId)
 {
     mPacksMutex.lock();
     mWaitPacks.remove_if([packetId](WaitPack pack){
-        return pack.id = packetId;
+        return pack.id == packetId;
     });
     mPacksMutex.unlock();
 }
@@ -0,0 +1,216 @@
+#include "blobstore.h"
+#include "sha256.h"
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+bool BlobStore::open(const string &dir, uint64_t maxBytes)
+{
+    lock_guard<mutex> guard(mLock);
+    mDir.clear();
+    mLru.clear();
+    mEntries.clear();
+    mTotalBytes = 0;
+    mMaxBytes = maxBytes;
+
+    if (dir.empty() || maxBytes == 0)
+        return false;
+
+    auto handle = opendir(dir.c_str());
+    if (handle == nullptr)
+        return false;
+
+    mDir = dir;
+    vector<pair<time_t, string>> found;
+    while (auto entry = readdir(handle))
+    {
+        string name = entry->d_name;
+        struct stat info;
+        if (!Sha256::isValidHex(name))
+        {
+            //上次存入时中断留下的临时文件
+            if (name.find(".part") != string::npos)
+                unlink(pathOf(name).c_str());
+            continue;
+        }
+
+        if (stat(pathOf(name).c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            continue;
+
+        found.push_back({info.st_mtime, name});
+        mEntries[name].size = info.st_size;
+        mTotalBytes += info.st_size;
+    }
+    closedir(handle);
+
+    sort(found.begin(), found.end(), [](const pair<time_t, string>& a, const pair<time_t, string>& b){
+        return a.first > b.first;
+    });
+    for (auto& item : found)
+    {
+        mLru.push_back(item.second);
+        mEntries[item.second].lru = prev(mLru.end());
+    }
+
+    trim();
+    return true;
+}
+
+bool BlobStore::fetch(const string &hash, const string &dest, int64_t size)
+{
+    string from;
+    {
+        lock_guard<mutex> guard(mLock);
+        auto found = mEntries.find(hash);
+        if (found == mEntries.end())
+            return false;
+        if (static_cast<int64_t>(found->second.size) != size)
+            return false;
+
+        touch(hash, found->second);
+        from = pathOf(hash);
+    }
+
+    //复制期间即使被淘汰，已打开的文件仍可读完
+    return copyFile(from, dest);
+}
+
+bool BlobStore::put(const string &hash, const string &src)
+{
+    static atomic<unsigned> partSeq{0};
+
+    struct stat info;
+    if (stat(src.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+        return false;
+
+    uint64_t size = info.st_size;
+    {
+        lock_guard<mutex> guard(mLock);
+        if (mDir.empty() || size > mMaxBytes)
+            return false;
+
+        auto found = mEntries.find(hash);
+        if (found != mEntries.end())
+        {
+            touch(hash, found->second);
+            return true;
+        }
+    }
+
+    //先复制再校验副本，校验的正是将要存入的内容
+    auto part = pathOf(hash) + ".part" + to_string(++partSeq);
+    if (!copyFile(src, part) || Sha256::ofFile(part) != hash)
+    {
+        unlink(part.c_str());
+        return false;
+    }
+
+    lock_guard<mutex> guard(mLock);
+    if (mDir.empty() || mEntries.count(hash) > 0 || rename(part.c_str(), pathOf(hash).c_str()) != 0)
+    {
+        unlink(part.c_str());
+        return mEntries.count(hash) > 0;
+    }
+
+    mLru.push_front(hash);
+    mEntries[hash] = {size, mLru.begin()};
+    mTotalBytes += size;
+    trim();
+    return true;
+}
+
+uint64_t BlobStore::totalBytes() const
+{
+    lock_guard<mutex> guard(mLock);
+    return mTotalBytes;
+}
+
+size_t BlobStore::count() const
+{
+    lock_guard<mutex> guard(mLock);
+    return mEntries.size();
+}
+
+string BlobStore::pathOf(const string &hash) const
+{
+    return mDir + "/" + hash;
+}
+
+void BlobStore::touch(const string &hash, Entry &entry)
+{
+    mLru.splice(mLru.begin(), mLru, entry.lru);
+    //修改时间即最近使用时间，重启后据此恢复淘汰顺序
+    utime(pathOf(hash).c_str(), nullptr);
+}
+
+void BlobStore::trim()
+{
+    while (mTotalBytes > mMaxBytes && !mLru.empty())
+    {
+        auto hash = mLru.back();
+        mLru.pop_back();
+        auto found = mEntries.find(hash);
+        mTotalBytes -= found->second.size;
+        mEntries.erase(found);
+        unlink(pathOf(hash).c_str());
+    }
+}
+
+bool BlobStore::copyFile(const string &from, const string &to)
+{
+    int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return false;
+
+    int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+
+    bool ok = false;
+#if defined(FICLONE)
+    //同一支持reflink的文件系统上只复制元数据
+    ok = ioctl(out, FICLONE, in) == 0;
+#endif
+
+    if (!ok)
+    {
+        ok = true;
+        vector<char> buf(64*1024);
+        ssize_t got = 0;
+        while (ok && (got = read(in, buf.data(), buf.size())) > 0)
+        {
+            for (ssize_t written = 0; written < got;)
+            {
+                auto ret = write(out, buf.data() + written, got - written);
+                if (ret <= 0)
+                {
+                    ok = false;
+                    break;
+                }
+                written += ret;
+            }
+        }
+        if (got < 0)
+            ok = false;
+    }
+
+    close(in);
+    if (close(out) != 0)
+        ok = false;
+    if (!ok)
+        unlink(to.c_str());
+    return ok;
+}
@@ -0,0 +1,66 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+using namespace std;
+
+/**
+ * @brief The BlobStore class 按内容寻址的本地文件缓存
+ * 每个文件以其SHA-256命名存放在缓存目录，总大小超出上限时淘汰最久未用的。
+ * 取出和存入都是复制（文件系统支持时为reflink），缓存中的文件不会被用户改动影响。
+ */
+class BlobStore
+{
+public:
+    BlobStore() = default;
+
+public:
+    /**
+     * @brief open 打开缓存目录，扫描已有文件，以修改时间作为最近使用时间
+     * @param maxBytes 缓存总大小上限，0表示不缓存
+     * @return 目录是否可用
+     */
+    bool open(const string& dir, uint64_t maxBytes);
+    bool isOpen() const{return !mDir.empty();}
+
+    /**
+     * @brief fetch 缓存中有该文件时复制到dest
+     * @param size 期望的文件大小，不一致视为未命中
+     * @return 是否命中并复制成功
+     */
+    bool fetch(const string& hash, const string& dest, int64_t size);
+    /**
+     * @brief put 校验src的摘要与hash一致后存入缓存
+     * @return 是否存入（已存在也算）
+     */
+    bool put(const string& hash, const string& src);
+
+    uint64_t totalBytes() const;
+    size_t count() const;
+
+private:
+    struct Entry
+    {
+        uint64_t size;
+        list<string>::iterator lru;
+    };
+
+    string pathOf(const string& hash) const;
+    void touch(const string& hash, Entry& entry);
+    void trim();
+    static bool copyFile(const string& from, const string& to);
+
+private:
+    string mDir;
+    uint64_t mMaxBytes=0;
+    uint64_t mTotalBytes=0;
+    list<string> mLru;//最近用过的在前
+    unordered_map<string, Entry> mEntries;
+    mutable mutex mLock;
+};
+
+#endif // BLOBSTORE_H
@@ -87,6 +87,8 @@ public:
     int size = 0;
     int modifyTime = 0;
     int fileType = 0;
+    string hash;//内容的SHA-256，仅KyLink好友间携带，为空表示未知
+    bool inlineImage = false;//内嵌图片，仅KyLink好友间携带
 
 public:
     static unique_ptr<FileContent> createFileContentToSend(const string& filePath)
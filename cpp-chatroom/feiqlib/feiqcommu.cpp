@@ -4,25 +4,40 @@
 #include <arpa/inet.h>
 #include "fellow.h"
 #include <sstream>
+#include <functional>
 #include <QDebug>
 #include <limits.h>
+#include <time.h>
 #include "utils.h"
+#include <algorithm>
+#include <unistd.h>
+#include <thread>
 
 FeiqCommu::FeiqCommu()
+    :mPacketNo(static_cast<IdType>(time(nullptr)))//与ipmsg一致，以时间为起点，重启后包序号不与上次重复
 {
 }
 
-void FeiqCommu::setMyHost(string host){mHost=host;}
+void FeiqCommu::setMyHost(string host){
+    mHost=host;
+    mHostGbk=encOut->convert(mHost);
+}
 
 void FeiqCommu::setMyName(string name){
     mName=name;
     std::replace(mName.begin(), mName.end(), HLIST_ENTRY_SEPARATOR, (char)HOSTLIST_DUMMY);
+    mNameGbk=encOut->convert(mName);
 }
 
 void FeiqCommu::addRecvProtocol(RecvProtocol *protocol){
     mRecvPrtocols.push_back(protocol);
 }
 
+//文件服务：listen队列长度，总并发连接数，单个好友的并发连接数
+static const int kFileServerBacklog = 128;
+static const int kMaxFileClients = 64;
+static const int kMaxFileClientsPerIp = 8;
+
 pair<bool, string> FeiqCommu::start()
 {
     if (!mUdp.bindTo(IPMSG_PORT))
@@ -39,11 +54,12 @@ pair<bool, string> FeiqCommu::start()
         return {false, "start aysnc recv failed:"+mUdp.getErrMsg()};
     }
 
-    if (!mTcpServer.start(IPMSG_PORT)){
+    mTcpServer.whenNewClient(std::bind(&FeiqCommu::onTcpClientConnected, this, placeholders::_1));
+    mTcpServer.setLimits(kMaxFileClients, kMaxFileClientsPerIp);
+    if (!mTcpServer.start(IPMSG_PORT, kFileServerBacklog)){
         mUdp.close();
         return {false, "无法启动文件服务"};
     }
-    mTcpServer.whenNewClient(std::bind(&FeiqCommu::onTcpClientConnected, this, placeholders::_1));
 
     //其他字段是什么意思呢？
     mMac = mUdp.getBoundMac();
@@ -54,6 +70,16 @@ pair<bool, string> FeiqCommu::start()
 void FeiqCommu::stop()
 {
     mUdp.close();
+    mTcpServer.stop();
+    mFilePool.clear();
+}
+
+pair<bool, string> FeiqCommu::joinMulticast(const string &group, int ttl)
+{
+    if (!mUdp.joinMulticast(group, ttl))
+        return {false, "join multicast failed:"+mUdp.getErrMsg()};
+
+    return {true, ""};
 }
 
 pair<IdType, string> FeiqCommu::send(const string &ip, SendProtocol &sender)
@@ -63,6 +89,21 @@ pair<IdType, string> FeiqCommu::send(const string &ip, SendProtocol &sender)
     auto out = pack(sender, &packetNo);
 
     //发送
+    return sendPacked(ip, sender, out, packetNo);
+}
+
+pair<IdType, string> FeiqCommu::resend(const string &ip, SendProtocol &sender, IdType packetNo)
+{
+    auto out = pack(sender, nullptr, packetNo);
+    return sendPacked(ip, sender, out, packetNo);
+}
+
+pair<IdType, string> FeiqCommu::sendPacked(const string &ip, SendProtocol &sender,
+                                           const vector<char> &out, IdType packetNo)
+{
+    if (out.size() > MAX_RCV_SIZE && sender.isFragmentable())
+        return sendFragments(ip, out, packetNo);
+
     auto ret = mUdp.sentTo(ip, IPMSG_PORT, out.data(), out.size());
     if (ret < 0)
         return {0, mUdp.getErrMsg()};
@@ -70,6 +111,51 @@ pair<IdType, string> FeiqCommu::send(const string &ip, SendProtocol &sender)
     return {packetNo, ""};
 }
 
+class SendFragment : public SendProtocol
+{
+public:
+    IdType packetNo;
+    int index;
+    int total;
+    const char* data;
+    size_t size;
+
+    int cmdId() override {return IPMSG_FRAGMENT;}
+    void write(ostream& os) override
+    {
+        char sep = HLIST_ENTRY_SEPARATOR;
+        os<<packetNo<<sep
+         <<index<<sep
+        <<total<<sep
+        <<size<<sep;
+        os.write(data, size);
+    }
+};
+
+pair<IdType, string> FeiqCommu::sendFragments(const string &ip, const vector<char> &out, IdType packetNo)
+{
+    if (out.size() > KYLINK_MAX_MESSAGE_SIZE)
+        return {0, "消息过长"};
+
+    SendFragment fragment;
+    fragment.packetNo = packetNo;
+    fragment.total = static_cast<int>((out.size() + KYLINK_FRAGMENT_PAYLOAD - 1) / KYLINK_FRAGMENT_PAYLOAD);
+
+    for (fragment.index = 0; fragment.index < fragment.total; ++fragment.index)
+    {
+        size_t offset = static_cast<size_t>(fragment.index) * KYLINK_FRAGMENT_PAYLOAD;
+        fragment.data = out.data() + offset;
+        fragment.size = std::min<size_t>(KYLINK_FRAGMENT_PAYLOAD, out.size() - offset);
+
+        auto packed = pack(fragment);
+        auto ret = mUdp.sentTo(ip, IPMSG_PORT, packed.data(), packed.size());
+        if (ret < 0)
+            return {0, mUdp.getErrMsg()};
+    }
+
+    return {packetNo, ""};
+}
+
 class SendRequestFile : public SendProtocol
 {
 public:
@@ -77,8 +163,17 @@ public:
     int fileid;
     int offset=0;
     int packetNo;
-
-    int cmdId() override {return filetype == IPMSG_FILE_DIR ? IPMSG_GETDIRFILES : IPMSG_GETFILEDATA;}
+    bool keepAlive=false;
+    bool compress=false;
+
+    int cmdId() override {
+        auto cmd = filetype == IPMSG_FILE_DIR ? IPMSG_GETDIRFILES : IPMSG_GETFILEDATA;
+        if (keepAlive)
+            cmd |= IPMSG_KEEPALIVEOPT;
+        if (compress)
+            cmd |= IPMSG_COMPRESSOPT;
+        return cmd;
+    }
     void write(ostream& os) override
     {
         char sep = HLIST_ENTRY_SEPARATOR;
@@ -88,24 +183,74 @@ public:
     }
 };
 
+//建立文件连接的超时（毫秒）
+static const int kFileConnectTimeo = 3000;
+
 unique_ptr<TcpSocket> FeiqCommu::requestFileData(const string &ip,
                                 const FileContent& file, int offset)
 {
     unique_ptr<TcpSocket> client(new TcpSocket());
-    if (!client->connect(ip, IPMSG_PORT))
+    if (!client->connect(ip, IPMSG_PORT, kFileConnectTimeo))
         return nullptr;
 
+    if (!sendFileRequest(*client, file, offset, false))
+        return nullptr;
+
+    return client;
+}
+
+//文件连接的内核缓冲区，局域网内大窗口才能跑满带宽
+static const int kFileSocketBuffer = 256*1024;
+
+unique_ptr<TcpSocket> FeiqCommu::acquireFileConnection(const string &ip)
+{
+    auto client = mFilePool.acquire(ip, IPMSG_PORT, kFileConnectTimeo);
+    if (client != nullptr)
+    {
+        client->setNoDelay(true);//请求很小，不等Nagle凑包
+        client->setBufferSizes(0, kFileSocketBuffer);
+    }
+    return client;
+}
+
+bool FeiqCommu::sendFileRequest(TcpSocket &client, const FileContent &file, int offset, bool keepAlive)
+{
     SendRequestFile requestSender;
     requestSender.packetNo = file.packetNo;
     requestSender.fileid = file.fileId;
     requestSender.offset = offset;
+    requestSender.keepAlive = keepAlive;
     auto request = pack(requestSender);
 
-    int ret = client->send(request.data(), request.size());
-    if (ret < 0)
-        return nullptr;
+    return client.send(request.data(), request.size()) >= 0;
+}
 
-    return client;
+bool FeiqCommu::sendFileRequests(TcpSocket &client, const vector<const FileContent *> &files,
+                                 bool keepAlive, bool compress)
+{
+    vector<vector<char>> requests;
+    vector<iovec> iov;
+    requests.reserve(files.size());
+    iov.reserve(files.size());
+
+    SendRequestFile requestSender;
+    requestSender.keepAlive = keepAlive;
+    requestSender.compress = compress;
+    for (auto file : files)
+    {
+        requestSender.packetNo = file->packetNo;
+        requestSender.fileid = file->fileId;
+        requests.push_back(pack(requestSender));
+        iov.push_back({requests.back().data(), requests.back().size()});
+    }
+
+    //多个请求一次系统调用发出
+    return client.sendv(iov.data(), iov.size()) >= 0;
+}
+
+void FeiqCommu::releaseFileConnection(unique_ptr<TcpSocket> client)
+{
+    mFilePool.release(std::move(client));
 }
 
 void FeiqCommu::setFileServerHandler(FileServerHandler fileServerHandler)
@@ -113,6 +258,16 @@ void FeiqCommu::setFileServerHandler(FileServerHandler fileServerHandler)
     mFileServerHandler = fileServerHandler;
 }
 
+void FeiqCommu::setDuplicateHandler(DuplicateHandler duplicateHandler)
+{
+    mDuplicateHandler = duplicateHandler;
+}
+
+pair<uint64_t, uint64_t> FeiqCommu::dedupStats() const
+{
+    return {mDedup.lookups(), mDedup.hits()};
+}
+
 void FeiqCommu::onRecv(const string &ip, vector<char> &data)
 {
     auto post = make_shared<Post>();
@@ -126,6 +281,14 @@ void FeiqCommu::onRecv(const string &ip, vector<char> &data)
     auto info = dumpVersionInfo(post->from->version());
     post->from->setMac(info.mac);
 
+    //记录对方是否支持UTF-8，之后与其收发可免去转码
+    if (post->isUtf8() || IS_OPT_SET(post->cmdId, IPMSG_CAPUTF8OPT))
+        post->from->setUtf8(true);
+    if (IS_OPT_SET(post->cmdId, IPMSG_KYLINKOPT))
+        post->from->setKyLink(true);
+    if (IS_OPT_SET(post->cmdId, IPMSG_KYLINKOPT) && IS_OPT_SET(post->cmdId, IPMSG_COMPRESSOPT))
+        post->from->setCompression(true);
+
     //屏蔽自己的包 - MAC为空或全0时不依赖MAC判断
     auto isValidMac = [](const std::string& mac) {
         if (mac.empty()) return false;
@@ -137,7 +300,8 @@ void FeiqCommu::onRecv(const string &ip, vector<char> &data)
     
     bool isSelfPacket = false;
     if (isValidMac(mMac) && isValidMac(post->from->getMac())) {
-        isSelfPacket = (mMac == post->from->getMac() && mName == post->from->getName());
+        auto name = post->from->getName();
+        isSelfPacket = (mMac == post->from->getMac() && (mNameGbk == name || mName == name));
     }
     
     if (isSelfPacket)
@@ -145,6 +309,28 @@ void FeiqCommu::onRecv(const string &ip, vector<char> &data)
 
     //除非收到下线包，否则都认为在线
     post->from->setOnLine(true);
+    post->from->setLastSeen(post->when.time_since_epoch().count());
+
+    //同一个包可能因重发或多网卡广播到达多次，只处理第一次
+    //带MAC时按发送方主机而非来源ip识别：多网卡主机的同一个包从不同地址到达也能认出
+    //经典飞鸽客户端不带MAC，主机名可能相同（同一镜像的板子），只能连同来源ip一起识别
+    auto packetNo = strtoull(post->packetNo.c_str(), nullptr, 10);
+    auto hostKey = isValidMac(post->from->getMac())
+            ? post->from->getMac()
+            : post->from->getHost() + "|" + post->from->getName() + "|" + ip;
+    if (packetNo != 0 && mDedup.checkAndInsert(std::hash<string>()(hostKey), packetNo))
+    {
+        if (mDuplicateHandler)
+            mDuplicateHandler(post);
+        return;
+    }
+
+    //超长包的分片，到齐后按原包重新处理
+    if (IS_CMD_SET(post->cmdId, IPMSG_FRAGMENT))
+    {
+        onFragment(ip, *post);
+        return;
+    }
 
     //调用协议处理
     for (auto& handler : mRecvPrtocols)
@@ -154,16 +340,53 @@ void FeiqCommu::onRecv(const string &ip, vector<char> &data)
     }
 }
 
-vector<char> FeiqCommu::pack(SendProtocol &sender, IdType* packetId)
+void FeiqCommu::onFragment(const string &ip, const Post &post)
+{
+    //原包序号:分片序号:分片总数:本片长度:数据
+    auto& extra = post.extra;
+    auto ptr = extra.begin();
+    array<unsigned long long, 4> values;
+    for (auto& value : values)
+    {
+        auto found = std::find(ptr, extra.end(), HLIST_ENTRY_SEPARATOR);
+        if (found == extra.end())
+            return;
+
+        value = strtoull(string(ptr, found).c_str(), nullptr, 10);
+        ptr = found+1;
+    }
+
+    auto offset = static_cast<size_t>(std::distance(extra.begin(), ptr));
+    auto size = static_cast<size_t>(values[3]);
+    if (extra.size() - offset < size)
+        return;
+
+    vector<char> whole;
+    if (mFragments.add(ip, values[0], static_cast<int>(values[1]), static_cast<int>(values[2]),
+                       extra.data() + offset, size, whole))
+    {
+        onRecv(ip, whole);
+    }
+}
+
+vector<char> FeiqCommu::pack(SendProtocol &sender, IdType* packetId, IdType retryOf)
 {
     //搜集数据
     char sep  = HLIST_ENTRY_SEPARATOR;
-    auto packetNo = mPacketNo.get();
+    auto packetNo = retryOf != 0 ? retryOf : mPacketNo.get();
     auto cmdId = sender.cmdId();
+    if (retryOf != 0)
+        cmdId |= IPMSG_RETRYOPT;
+    auto utf8 = sender.isUtf8();
+    if (utf8)
+        cmdId |= IPMSG_UTF8OPT;
 
     //拼接消息头
     stringstream os;
-    os<<mVersion<<sep<<packetNo<<sep<<mName<<sep<<mHost<<sep<<cmdId<<sep;
+    os<<mVersion<<sep<<packetNo<<sep
+     <<(utf8 ? mName : mNameGbk)<<sep
+    <<(utf8 ? mHost : mHostGbk)<<sep
+    <<cmdId<<sep;
 
     //组装消息
     sender.write(os);
@@ -183,18 +406,58 @@ vector<char> FeiqCommu::pack(SendProtocol &sender, IdType* packetId)
 
 void FeiqCommu::onTcpClientConnected(int socket)
 {
+    //已在TcpServer的工作线程中
     if (mFileServerHandler)
+        serveFileClient(socket);
+    else
+        close(socket);
+}
+
+//读完首个请求的期限，以及保持连接时等到下一个请求的期限（毫秒），
+//是整个请求的期限而非单次读的超时，一点点慢慢发的客户端也会被断开
+static const int kFileRequestTimeo = 2000;
+static const int kFileKeepAliveTimeo = 30000;
+
+void FeiqCommu::serveFileClient(int socket)
+{
+    TcpSocket client(socket);
+    client.setBufferSizes(kFileSocketBuffer, 0);
+    vector<char> pending;
+    std::array<char,MAX_RCV_SIZE> buf;
+    bool first = true;
+    auto deadline = steady_clock::now() + milliseconds(kFileRequestTimeo);
+
+    while (true)
     {
-        //接收请求
-        unique_ptr<TcpSocket> client(new TcpSocket(socket));
-        std::array<char,MAX_RCV_SIZE> buf;
-        int ret = client->recv(buf.data(), MAX_RCV_SIZE);
-        if (ret <= 0)
-            return;
+        //每个请求以NUL结尾，对方可能连续发来多个（流水线），逐个取出处理
+        auto end = std::find(pending.begin(), pending.end(), '\0');
+        if (end == pending.end())
+        {
+            if (pending.size() >= MAX_RCV_SIZE)
+                return;
+
+            auto left = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+            if (left <= 0)
+                return;
+
+            int ret = client.recv(buf.data(), MAX_RCV_SIZE, static_cast<int>(left));
+            if (ret <= 0)
+                return;
+
+            pending.insert(pending.end(), buf.begin(), buf.begin()+ret);
+            end = std::find(pending.begin(), pending.end(), '\0');
+            if (end == pending.end())
+            {
+                if (!first)
+                    continue;
+                end = pending.end()-1;//旧版客户端一次发完请求，未必以NUL结尾
+            }
+        }
 
         //解析请求
-        vector<char> request(ret);
-        std::copy(buf.begin(), buf.begin()+ret, request.begin());
+        vector<char> request(pending.begin(), end+1);
+        pending.erase(pending.begin(), end+1);
+        first = false;
 
         Post post;
         if (!dumpRaw(request, post))
@@ -204,12 +467,18 @@ void FeiqCommu::onTcpClientConnected(int socket)
         if (values.size() < 3)
             return;
 
-        int packetNo = stoi(values[0], 0, 16);
-        int fileId = stoi(values[1], 0, 16);
-        int offset = stoi(values[2], 0, 16);
+        int packetNo = strtol(values[0].c_str(), nullptr, 16);
+        int fileId = strtol(values[1].c_str(), nullptr, 16);
+        int offset = strtol(values[2].c_str(), nullptr, 16);
+
+        //处理请求，发完且对方要求保持连接，则等待下一个请求
+        auto compress = IS_OPT_SET(post.cmdId, IPMSG_COMPRESSOPT);
+        if (!mFileServerHandler(client, packetNo, fileId, offset, compress))
+            return;
+        if (!IS_OPT_SET(post.cmdId, IPMSG_KEEPALIVEOPT))
+            return;
 
-        //处理请求
-        mFileServerHandler(std::move(client), packetNo, fileId, offset);
+        deadline = steady_clock::now() + milliseconds(kFileKeepAliveTimeo);
     }
 }
 
@@ -13,7 +13,10 @@
 #include "encoding.h"
 #include "tcpsocket.h"
 #include "tcpserver.h"
+#include "tcppool.h"
 #include "uniqueid.h"
+#include "packetdedup.h"
+#include "fragmentassembler.h"
 using namespace std;
 
 struct VersionInfo
@@ -27,10 +30,14 @@ struct VersionInfo
 class FeiqCommu
 {
 public:
-    typedef function<void (unique_ptr<TcpSocket>, int packetNo, int fileId, int offset)> FileServerHandler;
+    typedef function<bool (TcpSocket& client, int packetNo, int fileId, int offset, bool compress)> FileServerHandler;
+    typedef function<void (shared_ptr<Post> post)> DuplicateHandler;
     FeiqCommu();
 
 public:
+    /**
+     * @brief setMyHost/setMyName 设置本机信息（UTF-8），打包时按对方能力选择UTF-8或GBK
+     */
     void setMyHost(string host);
     void setMyName(string name);
     void addRecvProtocol(RecvProtocol* protocol);
@@ -51,6 +58,13 @@ public:
      */
     pair<IdType, string> send(const string& ip, SendProtocol& sender);
 
+    /**
+     * @brief resend 以原包序号重发（带IPMSG_RETRYOPT），对方可据此去重并重新回执
+     * @param packetNo 首次发送时得到的包序号
+     * @return 同send
+     */
+    pair<IdType, string> resend(const string& ip, SendProtocol& sender, IdType packetNo);
+
     /**
      * @brief requestFileData 请求好友开始发送文件数据
      * @param ip 向谁请求
@@ -60,27 +74,83 @@ public:
     unique_ptr<TcpSocket> requestFileData(const string& ip, const FileContent &file, int offset);
 
     /**
-     * @brief setFileServerHandler 设置文件服务的处理
-     * @param fileServerHandler 参数：客户端socket连接，请求的文件id，请求的数据偏移
+     * @brief acquireFileConnection 取一条到好友文件服务的连接，优先复用空闲连接
+     * @return 连接失败返回nullptr
+     */
+    unique_ptr<TcpSocket> acquireFileConnection(const string& ip);
+    /**
+     * @brief sendFileRequest 在已有连接上发送一个文件请求
+     * @param keepAlive 发完后对方是否保持连接，仅KyLink好友支持
+     */
+    bool sendFileRequest(TcpSocket& client, const FileContent &file, int offset, bool keepAlive);
+    /**
+     * @brief sendFileRequests 一次发出多个文件请求（流水线），对方按顺序逐个发回文件数据
+     * @param compress 请求对方以分块格式发送（可压缩），仅对方supportsCompression时可用
+     */
+    bool sendFileRequests(TcpSocket& client, const vector<const FileContent*>& files,
+                          bool keepAlive, bool compress);
+    /**
+     * @brief releaseFileConnection 归还连接以便复用，调用方须已读完所有请求的数据
+     */
+    void releaseFileConnection(unique_ptr<TcpSocket> client);
+
+    /**
+     * @brief setFileServerHandler 设置文件服务的处理，在该连接的服务线程中同步调用
+     * @param fileServerHandler 参数：客户端socket连接，请求的文件id，请求的数据偏移，是否以分块格式发送；
+     * 返回是否完整发送，完整发送且对方要求保持连接时，继续等待同一连接上的下一个请求
      */
     void setFileServerHandler(FileServerHandler fileServerHandler);
+
+    /**
+     * @brief setDuplicateHandler 设置重复包的处理。重复包不再进入解析链，
+     * 但对方可能是因为没收到回执才重发，需要借此补发回执
+     */
+    void setDuplicateHandler(DuplicateHandler duplicateHandler);
+
+    /**
+     * @brief dedupStats 去重缓存的统计
+     * @return 查询次数，命中（被丢弃的重复包）次数
+     */
+    pair<uint64_t, uint64_t> dedupStats() const;
+
+    /**
+     * @brief isLocalBroadcast ip是否为本机某块网卡的子网广播，全局广播已覆盖这些网段
+     */
+    bool isLocalBroadcast(const string& ip) const{return mUdp.isLocalBroadcast(ip);}
+
+    /**
+     * @brief joinMulticast 加入组播组，之后可用send发往该组
+     * @return 是否加入成功，如果失败，返回具体失败原因
+     */
+    pair<bool, string> joinMulticast(const string& group, int ttl);
 public:
     static bool dumpRaw(vector<char> &data, Post &post);
     static VersionInfo dumpVersionInfo(const string& version);
 private:
     void onRecv(const string& ip, vector<char> &data);
-    vector<char> pack(SendProtocol& sender, IdType *packetId = nullptr);
+    void onFragment(const string& ip, const Post& post);
+    vector<char> pack(SendProtocol& sender, IdType *packetId = nullptr, IdType retryOf = 0);
+    pair<IdType, string> sendPacked(const string& ip, SendProtocol& sender,
+                                    const vector<char>& out, IdType packetNo);
+    pair<IdType, string> sendFragments(const string& ip, const vector<char>& out, IdType packetNo);
     void onTcpClientConnected(int socket);
+    void serveFileClient(int socket);
 private:
     vector<RecvProtocol*> mRecvPrtocols;
     UdpCommu mUdp;
     string mHost="";
     string mName="";
+    string mHostGbk="";//旧版飞秋只认GBK，预先转好，免得每包都转码
+    string mNameGbk="";
     string mVersion="";
     UniqueId mPacketNo;
     string mMac;
     TcpServer mTcpServer;
+    TcpPool mFilePool;//下载文件用的连接，按好友复用
     FileServerHandler mFileServerHandler;
+    DuplicateHandler mDuplicateHandler;
+    PacketDedup mDedup;
+    FragmentAssembler mFragments;
 };
 
 #endif // FEIQCOMMU_H
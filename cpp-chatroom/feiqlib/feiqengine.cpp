@@ -5,10 +5,17 @@
 #include "utils.h"
 #include <fstream>
 #include "defer.h"
+#include "transfercodec.h"
+#include "sha256.h"
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <iostream>
 #include <iomanip>
+#include <random>
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <sys/stat.h>
 
 class ContentSender : public SendProtocol
 {
@@ -22,6 +29,9 @@ protected:
     const Content* mContent;
 };
 
+//旧版飞秋只有MAX_RCV_SIZE的接收缓冲，给包头等留出余量
+static const size_t kLegacyTextBudget = MAX_RCV_SIZE - 512;
+
 class SendTextContent : public ContentSender
 {
 public:
@@ -29,15 +39,28 @@ public:
     void write(ostream& os) override
     {
         auto content = static_cast<const TextContent*>(mContent);
-        if (content->format.empty())
+        auto text = encode(content->text);
+        auto format = content->format.empty() ? string() : encode(content->format);
+
+        //KyLink好友可分片重组；旧版飞秋会把超出部分静默丢掉，这里按字符边界截断并注明
+        if (!isFragmentable() && text.size() + format.size() + 2 > kLegacyTextBudget)
         {
-            os<<encOut->convert(content->text);
+            auto mark = encode("\n……(消息过长，已截断)");
+            if (format.size() + 2 > kLegacyTextBudget / 2)
+                format.clear();
+            auto budget = kLegacyTextBudget - mark.size() - (format.empty() ? 0 : format.size() + 2);
+            text = truncateEncoded(text, budget, isUtf8()) + mark;
+        }
+
+        if (format.empty())
+        {
+            os<<text;
         }
         else
         {
-            os<<encOut->convert(content->text)
+            os<<text
              <<"{"
-            <<encOut->convert(content->format)
+            <<format
             <<"}";
         }
     }
@@ -63,15 +86,20 @@ public:
         os<<(char)0
           <<to_string(content->fileId)
          <<sep
-        <<encOut->convert(filename)
+        <<encode(filename)
         <<sep
         <<std::hex<<content->size
         <<sep
         <<content->modifyTime
         <<sep
         <<content->fileType
-        <<sep
-        <<FILELIST_SEPARATOR;
+        <<sep;
+        //扩展属性：旧版飞秋忽略不认识的属性，但只对KyLink好友才值得带
+        if (isKyLink() && !content->hash.empty())
+            os<<std::hex<<IPMSG_FILE_KYHASH<<'='<<content->hash<<sep;
+        if (isKyLink() && content->inlineImage)
+            os<<std::hex<<IPMSG_FILE_KYINLINE<<"=1"<<sep;
+        os<<FILELIST_SEPARATOR;
     }
 };
 
@@ -79,7 +107,7 @@ class SendImOnLine : public SendProtocol
 {
 public:
     SendImOnLine(const string& name):mName(name){}
-    int cmdId() override{return IPMSG_BR_ENTRY;}
+    int cmdId() override{return IPMSG_BR_ENTRY|IPMSG_CAPUTF8OPT|IPMSG_KYLINKOPT|IPMSG_COMPRESSOPT;}
     void write(ostream &os) override
     {
         os<<encOut->convert(mName);
@@ -102,6 +130,25 @@ private:
     string mName;
 };
 
+/**
+ * @brief The SendReleaseFiles class 附件已收完，对方可以释放
+ */
+class SendReleaseFiles : public SendProtocol
+{
+public:
+    SendReleaseFiles(IdType packetNo)
+        :mPacketNo(packetNo){}
+
+    int cmdId() override{return IPMSG_RELEASEFILES;}
+
+    void write(ostream& os) override
+    {
+        os<<mPacketNo;
+    }
+private:
+    IdType mPacketNo;
+};
+
 /**
  * @brief The AnsSendCheck class 发送消息我收到了
  */
@@ -147,14 +194,22 @@ class AnsBrEntry : public SendProtocol
 public:
     AnsBrEntry(const string& myName):mName(myName){}
 public:
-    int cmdId() override { return IPMSG_ANSENTRY;}
+    int cmdId() override { return IPMSG_ANSENTRY|IPMSG_CAPUTF8OPT|IPMSG_KYLINKOPT|IPMSG_COMPRESSOPT;}
     void write(ostream &os) override {
-        os<<encOut->convert(mName);
+        os<<encode(mName);
     }
 private:
     const string& mName;
 };
 
+/**
+ * @brief decodeOf 对方以UTF-8发送时原样使用，仅旧版飞秋需要GBK转码
+ */
+static string decodeOf(const Post& post, const string& raw)
+{
+    return post.isUtf8() ? raw : encIn->convert(raw);
+}
+
 //定义触发器
 typedef std::function<void (shared_ptr<Post> post)> OnPostReady;
 #define DECLARE_TRIGGER(name)\
@@ -175,7 +230,7 @@ public:
     {
         if (IS_CMD_SET(post->cmdId, IPMSG_ANSENTRY))
         {
-            auto converted = toString(encIn->convert(post->extra));
+            auto converted = decodeOf(*post, toString(post->extra));
             post->from->setName(converted);
             trigger(post);
             return true;
@@ -194,7 +249,7 @@ public:
     {
         if (IS_CMD_SET(post->cmdId, IPMSG_BR_ENTRY))
         {
-            post->from->setName(toString(encIn->convert(post->extra)));
+            post->from->setName(decodeOf(*post, toString(post->extra)));
             trigger(post);
             return true;
         }
@@ -285,7 +340,7 @@ public:
             string rawText;
             rawText.assign(begin, found);
 
-            auto content = createTextContent(encIn->convert(rawText));
+            auto content = createTextContent(decodeOf(*post, rawText));
             post->contents.push_back(shared_ptr<Content>(std::move(content)));
         }
 
@@ -333,7 +388,7 @@ public:
             if (endTask == end)
                 break;
 
-            auto content = createFileContent(found, endTask);
+            auto content = createFileContent(*post, found, endTask);
             if (content != nullptr)
             {
                 content->packetNo = stoul(post->packetNo);
@@ -346,7 +401,8 @@ public:
         return false;
     }
 private:
-    unique_ptr<FileContent> createFileContent(vector<char>::iterator from,
+    unique_ptr<FileContent> createFileContent(const Post& post,
+                                          vector<char>::iterator from,
                                           vector<char>::iterator to)
     {
         unique_ptr<FileContent> content(new FileContent());
@@ -357,11 +413,27 @@ private:
             return nullptr;
 
         content->fileId = stoi(values[0]);
-        content->filename = encIn->convert(values[1]);
+        content->filename = decodeOf(post, values[1]);
         content->size = stoi(values[2],0,16);
         content->modifyTime = stoi(values[3],0,16);
         content->fileType = stoi(values[4],0,16);
 
+        //扩展属性为 属性=值，均为十六进制
+        for (size_t i = fieldCount; i < values.size(); i++)
+        {
+            auto& attr = values[i];
+            auto eq = attr.find('=');
+            if (eq == string::npos || eq == 0)
+                continue;
+
+            auto key = strtoul(attr.substr(0, eq).c_str(), nullptr, 16);
+            auto value = attr.substr(eq+1);
+            if (key == IPMSG_FILE_KYHASH && Sha256::isValidHex(value))
+                content->hash = value;
+            else if (key == IPMSG_FILE_KYINLINE)
+                content->inlineImage = value == "1";
+        }
+
         return content;
     }
 };
@@ -394,7 +466,7 @@ class RecvReadMessage : public RecvProtocol
 public:
     bool read(shared_ptr<Post> post)
     {
-        if (post->cmdId == IPMSG_RECVMSG)
+        if (IS_CMD_SET(post->cmdId, IPMSG_RECVMSG))
         {
             IdType id = static_cast<IdType>(stoll(toString(post->extra)));
             auto content = make_shared<IdContent>();
@@ -407,6 +479,31 @@ public:
     }
 };
 
+/**
+ * @brief The RecvReleaseFiles class 对方不再需要某个包里的文件（本地已有，或放弃接收）
+ */
+class RecvReleaseFiles : public RecvProtocol
+{
+    DECLARE_TRIGGER(RecvReleaseFiles)
+public:
+    bool read(shared_ptr<Post> post)
+    {
+        if (!IS_CMD_SET(post->cmdId, IPMSG_RELEASEFILES))
+            return false;
+
+        auto text = toString(post->extra);
+        auto id = strtoll(text.c_str(), nullptr, 10);
+        if (id <= 0)
+            return true;
+
+        auto content = make_shared<IdContent>();
+        content->id = static_cast<IdType>(id);
+        post->addContent(content);
+        trigger(post);
+        return true;
+    }
+};
+
 class RecvImage : public RecvProtocol
 {
 public:
@@ -440,6 +537,20 @@ public:
     }
 };
 
+/**
+ * @brief The RecvActivity class 任何包都说明对方还活着，刷新活跃时间后继续解析
+ */
+class RecvActivity : public RecvProtocol
+{
+    DECLARE_TRIGGER(RecvActivity)
+public:
+    bool read(shared_ptr<Post> post)
+    {
+        trigger(post);
+        return false;
+    }
+};
+
 //添加一条接收协议，触发时更新好友信息，并调用func
 #define ADD_RECV_PROTOCOL(protocol, func)\
 {\
@@ -467,6 +578,15 @@ public:
     mCommu.addRecvProtocol(p);\
 }
 
+//添加一条接收协议，触发时直接调用func，不更新好友信息
+#define ADD_RECV_PROTOCOL4(protocol, func)\
+{\
+    RecvProtocol* p = new protocol([this](shared_ptr<Post> post){\
+        this->func(post);});\
+    mRecvProtocols.push_back(unique_ptr<RecvProtocol>(p));\
+    mCommu.addRecvProtocol(p);\
+}
+
 //添加一条发送协议
 #define ADD_SEND_PROTOCOL(protocol, sender, args...)\
 {\
@@ -477,12 +597,15 @@ FeiqEngine::FeiqEngine()
 {
     ADD_RECV_PROTOCOL2(Debuger);//仅用于开发中的调试
 
-    ADD_RECV_PROTOCOL3(RecvAnsEntry);
+    ADD_RECV_PROTOCOL4(RecvActivity, onActivity);
+
+    ADD_RECV_PROTOCOL(RecvAnsEntry, onAnsEntry);
     ADD_RECV_PROTOCOL(RecvBrEntry, onBrEntry);
     ADD_RECV_PROTOCOL3(RecvBrExit);
     ADD_RECV_PROTOCOL(RecvSendCheck, onSendCheck);
     ADD_RECV_PROTOCOL(RecvReadCheck, onReadCheck);
     ADD_RECV_PROTOCOL(RecvReadMessage, onReadMessage);//好友回复消息已经阅读
+    ADD_RECV_PROTOCOL(RecvReleaseFiles, onReleaseFiles);
     ADD_RECV_PROTOCOL2(RecvText);
     ADD_RECV_PROTOCOL2(RecvImage);
     ADD_RECV_PROTOCOL2(RecvKnock);
@@ -498,21 +621,75 @@ FeiqEngine::FeiqEngine()
                                           placeholders::_1,
                                           placeholders::_2,
                                           placeholders::_3,
-                                          placeholders::_4));
+                                          placeholders::_4,
+                                          placeholders::_5));
+    mCommu.setDuplicateHandler(std::bind(&FeiqEngine::onDuplicate, this, placeholders::_1));
 }
 
+//可靠消息参数：首次等待回执500ms，每次重发翻倍，最多重发3次（总计约7.5s后报告超时）
+static const int kRetransmitTimeo = 500;
+static const int kMaxRetransmit = 3;
+//每个好友最多同时在途的未确认消息数，避免弱网下一次性灌出大量重发
+static const size_t kMaxInFlight = 4;
+
+//发文件时只对不超过该大小的文件计算摘要，免得大文件让发送卡住太久
+static const int kMaxHashedFileSize = 64*1024*1024;
+
 pair<bool, string> FeiqEngine::send(shared_ptr<Fellow> fellow, shared_ptr<Content> content)
 {
     if (content == nullptr)
         return {false, "要发送的内容无效"};
 
-    auto& sender = mContentSender[content->type()];
-    if (sender == nullptr)
+    if (content->type() == ContentType::Text)
+        return sendReliable(fellow, content);
+
+    if (mContentSender.find(content->type()) == mContentSender.end())
         return {false, "no send protocol can send"};
 
+    //KyLink好友本地可能已有相同文件，附上摘要让对方免于重复下载；
+    //摘要要读完整个文件，交给摘要线程算完再发通知，调用方（界面线程）不等
+    if (content->type() == ContentType::File && fellow->isKyLink() && mStarted)
+    {
+        auto file = static_cast<FileContent*>(content.get());
+        if (file->hash.empty() && file->fileType == IPMSG_FILE_REGULAR && file->size <= kMaxHashedFileSize)
+        {
+            auto msg = make_shared<OutgoingMsg>();
+            msg->fellow = fellow;
+            msg->content = content;
+            mHashThd.sendMessage(msg);
+            return {true, ""};
+        }
+    }
+
+    return sendContent(fellow, content);
+}
+
+void FeiqEngine::hashAndSend(shared_ptr<OutgoingMsg> msg)
+{
+    auto file = static_cast<FileContent*>(msg->content.get());
+    file->hash = Sha256::ofFile(file->path);
+
+    auto ret = sendContent(msg->fellow, msg->content);
+    if (!ret.first)
+    {
+        auto event = make_shared<SendTimeoEvent>();
+        event->fellow = msg->fellow;
+        event->content = msg->content;
+        mMsgThd.sendMessage(event);
+    }
+}
+
+pair<bool, string> FeiqEngine::sendContent(shared_ptr<Fellow> fellow, shared_ptr<Content> content)
+{
+    unique_lock<mutex> lock(mContentSenderLock);
+    auto& sender = mContentSender[content->type()];
     sender->setContent(content.get());
+    sender->setUtf8(fellow->supportsUtf8());
+    sender->setFragmentable(fellow->isKyLink());
+    sender->setKyLink(fellow->isKyLink());
     auto ip = fellow->getIp();
     auto ret = mCommu.send(ip, *sender);
+    lock.unlock();
     if (ret.first == 0)
     {
         return {false, ret.second};
@@ -524,13 +701,87 @@ pair<bool, string> FeiqEngine::send(shared_ptr<Fellow> fellow, shared_ptr<Conten
         auto ptr = dynamic_pointer_cast<FileContent>(content);
         mModel.addUploadTask(fellow, ptr)->setObserver(mView);
     }
-    else if (content->type() == ContentType::Text){
-        auto handler = std::bind(&FeiqEngine::onSendTimeo, this, placeholders::_1, ip, content);
-        mAsyncWait.addWaitPack(content->packetNo, handler, 5000);
+    return {true, ""};
+}
+
+pair<bool, string> FeiqEngine::sendReliable(shared_ptr<Fellow> fellow, shared_ptr<Content> content)
+{
+    OutgoingMsg msg;
+    msg.fellow = fellow;
+    msg.content = content;
+    msg.timeo = kRetransmitTimeo;
+
+    lock_guard<mutex> guard(mReliableLock);
+    auto& window = mReliable[fellow->getIp()];
+    if (window.inFlight.size() >= kMaxInFlight)
+    {
+        window.pending.push_back(msg);//窗口已满，等前面的消息确认后再发
+        return {true, ""};
     }
+
+    auto ret = transmit(msg);
+    if (!ret.first)
+        return ret;
+
+    window.inFlight.push_back(msg);
+    return {true, ""};
+}
+
+pair<bool, string> FeiqEngine::transmit(OutgoingMsg &msg)
+{
+    //用独立的sender，避免与其他线程共用mContentSender时互相覆盖内容
+    SendTextContent sender;
+    sender.setContent(msg.content.get());
+    sender.setUtf8(msg.fellow->supportsUtf8());
+    sender.setFragmentable(msg.fellow->isKyLink());
+    sender.setKyLink(msg.fellow->isKyLink());
+
+    auto ip = msg.fellow->getIp();
+    auto ret = msg.packetNo == 0
+            ? mCommu.send(ip, sender)
+            : mCommu.resend(ip, sender, msg.packetNo);
+    if (ret.first == 0)
+        return {false, ret.second};
+
+    msg.packetNo = ret.first;
+    msg.content->setPacketNo(ret.first);
+
+    auto handler = std::bind(&FeiqEngine::onSendTimeo, this, placeholders::_1, ip, msg.content);
+    mAsyncWait.addWaitPack(msg.packetNo, handler, msg.timeo);
     return {true, ""};
 }
 
+void FeiqEngine::pumpPending(ReliableWindow &window)
+{
+    while (window.inFlight.size() < kMaxInFlight && !window.pending.empty())
+    {
+        auto msg = window.pending.front();
+        window.pending.pop_front();
+
+        if (transmit(msg).first)
+        {
+            window.inFlight.push_back(msg);
+        }
+        else
+        {
+            auto event = make_shared<SendTimeoEvent>();
+            event->fellow = msg.fellow;
+            event->content = msg.content;
+            mMsgThd.sendMessage(event);
+        }
+    }
+}
+
+void FeiqEngine::onDuplicate(shared_ptr<Post> post)
+{
+    //对方没收到回执才会重发，补发回执，内容不再重复投递
+    if (IS_OPT_SET(post->cmdId, IPMSG_SENDCHECKOPT))
+    {
+        SendSentCheck reply(post->packetNo);
+        mCommu.send(post->from->getIp(), reply);
+    }
+}
+
 pair<bool, string> FeiqEngine::sendFiles(shared_ptr<Fellow> fellow, list<shared_ptr<FileContent>> &files)
 {
     for (auto file : files) {
@@ -547,11 +798,34 @@ bool FeiqEngine::downloadFile(FileTask* task)
         return false;
 
     task->setObserver(mView);
+    auto fellow = task->fellow();
+
+    //KyLink好友：排进该好友的下载队列，复用连接并流水线请求
+    if (fellow->isKyLink())
+    {
+        auto ip = fellow->getIp();
+        lock_guard<mutex> guard(mDownloadLock);
+        auto found = mDownloads.find(ip);
+        if (found != mDownloads.end())
+        {
+            found->second.push_back(task);//队列已在处理中
+        }
+        else
+        {
+            mDownloads[ip].push_back(task);
+            thread thd(&FeiqEngine::drainDownloads, this, ip);
+            thd.detach();
+        }
+        return true;
+    }
 
     auto func = [task, this](){
         auto fellow = task->fellow();
         auto content = task->getContent();
 
+        if (fetchFromBlobs(task))
+            return;
+
         auto client = mCommu.requestFileData(fellow->getIp(), *content, 0);
         if (client == nullptr)
         {
@@ -559,69 +833,221 @@ bool FeiqEngine::downloadFile(FileTask* task)
             return;
         }
 
-        FILE* of = fopen(content->path.c_str(), "w+");
-        if (of == nullptr){
-            task->setState(FileTaskState::Error, "无法打开文件进行保存");
-            return;
-        }
+        receiveFile(*client, task, false);
+    };
+
+    thread thd(func);
+    thd.detach();
+
+    return task;
+}
 
-//        Defer{//TODO:工作异常
-//            [of](){
-//                cout<<"close file now"<<endl;
-//                fclose(of);
-//            }
-//        };
+//一条连接上最多同时在途的文件请求
+static const size_t kDownloadPipelineDepth = 8;
+
+void FeiqEngine::drainDownloads(string ip)
+{
+    unique_ptr<TcpSocket> client;
+    list<FileTask*> requested;//已发出请求、尚未收完的文件，对方按请求顺序发回
 
-        const int unitSize = 2048;//一次请求2k
-        const int maxTimeoCnt = 3;//最多允许超时3次
-        const int timeo = 2000;//允许超时2s
+    //双方都支持时请求分块格式，由对方决定每块是否压缩
+    auto fellow = mModel.findFirstFellowOf(ip);
+    bool framed = TransferCodec::canCompress() && fellow != nullptr && fellow->supportsCompression();
 
-        int recv = 0;
-        auto total = content->size;
-        std::array<char, unitSize> buf;
-        int timeoCnt = 0;
-        task->setState(FileTaskState::Running);
-        while (recv < total)
+    while (true)
+    {
+        //补满流水线
+        vector<FileTask*> batch;
+        {
+            lock_guard<mutex> guard(mDownloadLock);
+            auto& queue = mDownloads[ip];
+            while (requested.size() + batch.size() < kDownloadPipelineDepth && !queue.empty())
+            {
+                batch.push_back(queue.front());
+                queue.pop_front();
+            }
+        }
+
+        vector<FileTask*> accepted;
+        vector<const FileContent*> files;
+        for (auto task : batch)
         {
             if (task->hasCancelPending())
             {
                 task->setState(FileTaskState::Canceled);
-                fclose(of);
-                return;
+                continue;
             }
+            //缓存命中时复制整个文件，与网络下载一样在下载线程中进行
+            if (fetchFromBlobs(task))
+                continue;
+            accepted.push_back(task);
+            files.push_back(task->getContent().get());
+        }
+        batch.swap(accepted);
 
-            auto left = total - recv;
-            auto request = unitSize > left ? left : unitSize;
-            auto got = client->recv(buf.data(), request, timeo);
-            if (got == -1 && ++timeoCnt >= maxTimeoCnt)
+        if (!batch.empty())
+        {
+            if (client == nullptr)
+                client = mCommu.acquireFileConnection(ip);
+
+            if (client == nullptr || !mCommu.sendFileRequests(*client, files, true, framed))
             {
-                task->setState(FileTaskState::Error, "下载文件超时，好友可能掉线");
-                fclose(of);
-                return;
+                batch.front()->setState(FileTaskState::Error, "请求下载文件失败，可能好友已经取消");
+                //这条连接上的请求都作废，其余的放回队首换新连接
+                client = nullptr;
+                lock_guard<mutex> guard(mDownloadLock);
+                auto& queue = mDownloads[ip];
+                queue.insert(queue.begin(), batch.begin()+1, batch.end());
+                queue.insert(queue.begin(), requested.begin(), requested.end());
+                requested.clear();
+                continue;
             }
-            else if (got < 0)
+
+            requested.insert(requested.end(), batch.begin(), batch.end());
+        }
+
+        if (requested.empty())
+        {
+            lock_guard<mutex> guard(mDownloadLock);
+            if (mDownloads[ip].empty())
             {
-                task->setState(FileTaskState::Error, "接收数据出错，可能网络错误");
-                fclose(of);
-                return;
+                mDownloads.erase(ip);
+                break;
             }
-            else
+            continue;
+        }
+
+        auto task = requested.front();
+        requested.pop_front();
+        if (!receiveFile(*client, task, framed))
+        {
+            //连接上的数据已经错位，其余已请求的文件放回队首，换新连接重新请求
+            client = nullptr;
+            lock_guard<mutex> guard(mDownloadLock);
+            auto& queue = mDownloads[ip];
+            queue.insert(queue.begin(), requested.begin(), requested.end());
+            requested.clear();
+        }
+    }
+
+    if (client != nullptr)
+        mCommu.releaseFileConnection(std::move(client));
+}
+
+bool FeiqEngine::fetchFromBlobs(FileTask *task)
+{
+    auto content = task->getContent();
+    if (content->hash.empty() || !mBlobs.fetch(content->hash, content->path, content->size))
+        return false;
+
+    task->setProcess(content->size);
+    task->setState(FileTaskState::Finish, "本地已有相同文件，未重新下载");
+
+    //每个文件单独一个包发出，释放该包即释放这个文件
+    SendReleaseFiles release(content->packetNo);
+    mCommu.send(task->fellow()->getIp(), release);
+    return true;
+}
+
+void FeiqEngine::storeToBlobs(FileTask *task)
+{
+    auto content = task->getContent();
+    if (!content->hash.empty() && mBlobs.isOpen())
+        mBlobs.put(content->hash, content->path);
+}
+
+bool FeiqEngine::receiveFile(TcpSocket &client, FileTask *task, bool framed)
+{
+    auto content = task->getContent();
+    FILE* of = fopen(content->path.c_str(), "w+");
+    if (of == nullptr){
+        task->setState(FileTaskState::Error, "无法打开文件进行保存");
+        return false;
+    }
+
+    const int unitSize = 64*1024;//一次最多收64k
+    const int maxTimeoCnt = 3;//最多允许超时3次
+    const int timeo = 2000;//允许超时2s
+
+    int recv = 0;
+    auto total = content->size;
+    vector<char> buf(unitSize);
+    vector<char> packed(framed ? TransferCodec::kChunkSize : 0);
+    int timeoCnt = 0;
+    task->setState(FileTaskState::Running);
+    while (recv < total)
+    {
+        if (task->hasCancelPending())
+        {
+            task->setState(FileTaskState::Canceled);
+            fclose(of);
+            return false;
+        }
+
+        int got;
+        if (framed)
+        {
+            //分块格式：先收块头，再收满整块，解码后的长度即本块的原始数据
+            char header[TransferCodec::kHeaderSize];
+            uint32_t rawSize, packedSize;
+            got = client.recvAll(header, sizeof(header), timeo);
+            if (got > 0)
             {
-                fwrite(buf.data(), 1, got, of);
-                recv+=got;
-                task->setProcess(recv);
+                if (!TransferCodec::parseHeader(header, rawSize, packedSize)
+                        || rawSize > static_cast<uint32_t>(total - recv))
+                {
+                    task->setState(FileTaskState::Error, "收到的数据格式错误");
+                    fclose(of);
+                    return false;
+                }
+
+                got = client.recvAll(packed.data(), packedSize, timeo);
+                if (got > 0 && !TransferCodec::decode(packed.data(), packedSize, buf.data(), rawSize))
+                {
+                    task->setState(FileTaskState::Error, "解压数据出错");
+                    fclose(of);
+                    return false;
+                }
+                if (got > 0)
+                    got = rawSize;
             }
         }
+        else
+        {
+            //只读本文件剩余的字节，连接上紧接着的可能是下一个文件
+            auto left = total - recv;
+            auto request = unitSize > left ? left : unitSize;
+            got = client.recv(buf.data(), request, timeo);
+        }
 
-        fclose(of);
-        task->setProcess(total);
-        task->setState(FileTaskState::Finish);
-    };
+        if (got == -1)
+        {
+            //分块格式下块可能只收了一半，无法续接
+            if (!framed && ++timeoCnt < maxTimeoCnt)
+                continue;
 
-    thread thd(func);
-    thd.detach();
+            task->setState(FileTaskState::Error, "下载文件超时，好友可能掉线");
+            fclose(of);
+            return false;
+        }
+        else if (got <= 0)
+        {
+            task->setState(FileTaskState::Error, got == 0 ? "好友关闭了连接" : "接收数据出错，可能网络错误");
+            fclose(of);
+            return false;
+        }
 
-    return task;
+        timeoCnt = 0;
+        fwrite(buf.data(), 1, got, of);
+        recv+=got;
+        task->setProcess(recv);
+    }
+
+    fclose(of);
+    storeToBlobs(task);
+    task->setProcess(total);
+    task->setState(FileTaskState::Finish);
+    return true;
 }
 
 class GetPubKey : public SendProtocol
@@ -640,8 +1066,8 @@ pair<bool, string> FeiqEngine::start()
         return {true, "已经启动过"};
     }
 
-    mCommu.setMyHost(encOut->convert(mHost));
-    mCommu.setMyName(encOut->convert(mName));
+    mCommu.setMyHost(mHost);
+    mCommu.setMyName(mName);
     auto result = mCommu.start();
 
     if(result.first)
@@ -650,8 +1076,12 @@ pair<bool, string> FeiqEngine::start()
 
         mMsgThd.start();
         mMsgThd.setHandler(std::bind(&FeiqEngine::dispatchMsg, this, placeholders::_1));
+        mHashThd.setHandler(std::bind(&FeiqEngine::hashAndSend, this, placeholders::_1));
+        mHashThd.start();
 
         mStarted = true;
+        mLivenessThd = thread(&FeiqEngine::livenessLoop, this);
+        restoreFellows();
         sendImOnLine();
     }
 
@@ -662,13 +1092,35 @@ void FeiqEngine::stop()
 {
     if (mStarted)
     {
-        mStarted=false;
+        {
+            lock_guard<mutex> guard(mHousekeepLock);
+            mStarted=false;
+        }
+        mHousekeepCnd.notify_all();
+        if (mPresenceThd.joinable())
+            mPresenceThd.join();
+        if (mLivenessThd.joinable())
+            mLivenessThd.join();
+
+        mHashThd.stop();//还没算完摘要的文件不再发出
+
         SendImOffLine imOffLine(mName);
-        mCommu.send("255.255.255.255", imOffLine);
-        broadcastToCurstomGroup(imOffLine);
+        announce(imOffLine);
         mCommu.stop();
         mAsyncWait.stop();
         mMsgThd.stop();
+
+        if (!mFellowCachePath.empty())
+            mModel.saveFellows(mFellowCachePath);
+
+        {
+            lock_guard<mutex> guard(mReliableLock);
+            mReliable.clear();
+        }
+
+        lock_guard<mutex> guard(mLivenessLock);
+        mLiveness.clear();
+        mLivenessWheel.clear();
     }
 }
 
@@ -690,14 +1142,39 @@ void FeiqEngine::setMyName(string name){
         mName = mHost;
 }
 
+pair<bool, string> FeiqEngine::enableMulticastDiscovery(const string &group, int ttl)
+{
+    if (!mStarted)
+        return {false, "尚未启动"};
+
+    auto result = mCommu.joinMulticast(group, ttl);
+    if (!result.first)
+        return result;
+
+    {
+        lock_guard<mutex> guard(mMulticastLock);
+        mMulticastGroup = group;
+    }
+
+    SendImOnLine imOnLine(mName);
+    mCommu.send(group, imOnLine);
+    return result;
+}
+
+string FeiqEngine::multicastGroup()
+{
+    lock_guard<mutex> guard(mMulticastLock);
+    return mMulticastGroup;
+}
+
 void FeiqEngine::sendImOnLine(const string &ip)
 {
     SendImOnLine imOnLine(mName);
 
     if (ip.empty())
     {
-        mCommu.send("255.255.255.255", imOnLine);
-        broadcastToCurstomGroup(imOnLine);
+        announce(imOnLine);
+        mLastAnnounce = Post::now().time_since_epoch().count();
     }
     else
     {
@@ -707,19 +1184,244 @@ void FeiqEngine::sendImOnLine(const string &ip)
 
 void FeiqEngine::enableIntervalDetect(int seconds)
 {
-    thread thd([this, seconds](){
-        while(mStarted)
+    if (seconds <= 0)
+        return;
+
+    mPresenceInterval = seconds;
+    if (mPresenceThd.joinable() || !mStarted)
+        return;
+
+    mPresenceThd = thread(&FeiqEngine::presenceLoop, this);
+}
+
+//存活检查参数：静默60秒后开始单播探测，每10秒一次，3次都没有回应则视为离线
+static const int64_t kLivenessQuiet = 60000;
+static const int64_t kLivenessProbeGap = 10000;
+static const int kLivenessProbes = 3;
+
+//好友列表连续稳定时，检测间隔最多翻倍到基础间隔的8倍
+static const int kMaxPresenceBackoff = 3;
+//每轮最多单播探测的好友数，避免好友很多时突发大量包
+static const int kMaxProbesPerRound = 16;
+
+void FeiqEngine::presenceLoop()
+{
+    mt19937 rng(random_device{}());
+    uniform_real_distribution<double> jitter(0.8, 1.2);
+    auto lastEpoch = mFellowEpoch.load();
+    int backoff = 0;
+
+    while (mStarted)
+    {
+        int64_t interval = (int64_t)mPresenceInterval * 1000 << backoff;
+        auto wait = milliseconds((int64_t)(interval * jitter(rng)));
+
+        {
+            unique_lock<mutex> lock(mHousekeepLock);
+            if (mHousekeepCnd.wait_for(lock, wait, [this]{return !mStarted;}))
+                break;
+        }
+
+        auto epoch = mFellowEpoch.load();
+        if (epoch != lastEpoch)
         {
-            sleep(seconds);
-            if (!mStarted)  break;
+            lastEpoch = epoch;
+            backoff = 0;
+        }
+        else if (backoff < kMaxPresenceBackoff)
+        {
+            ++backoff;
+        }
 
+        //本间隔内已经广播过（如手动刷新），不必重复
+        auto now = Post::now().time_since_epoch().count();
+        if (now - mLastAnnounce >= interval)
+        {
             SendImOnLine imOnLine(mName);
-            broadcastToCurstomGroup(imOnLine);
+            announce(imOnLine, multicastGroup().empty());
+            mLastAnnounce = now;
         }
+
+        //两个间隔都没有动静的好友，单播上线通知，对方会回应答包
+        probeQuietFellows(2 * interval);
+    }
+}
+
+void FeiqEngine::probeQuietFellows(int64_t quietMs)
+{
+    auto now = Post::now().time_since_epoch().count();
+    //活跃时间由接收线程随时更新，先取一份快照再排序，排序键不能中途改变
+    vector<pair<int64_t, shared_ptr<Fellow>>> quiet;
+    for (auto& fellow : mModel.onlineFellows())
+    {
+        auto lastSeen = fellow->lastSeen();
+        if (now - lastSeen >= quietMs)
+            quiet.emplace_back(lastSeen, fellow);
+    }
+
+    //存活检查已在探测的好友由它继续探测，这里不再重复发
+    {
+        lock_guard<mutex> guard(mLivenessLock);
+        quiet.erase(remove_if(quiet.begin(), quiet.end(), [this](const pair<int64_t, shared_ptr<Fellow>>& entry){
+            auto state = mLiveness.find(entry.second->getIp());
+            return state != mLiveness.end() && state->second.probes > 0;
+        }), quiet.end());
+    }
+
+    //最久未见的优先
+    sort(quiet.begin(), quiet.end(), [](const pair<int64_t, shared_ptr<Fellow>>& a,
+                                        const pair<int64_t, shared_ptr<Fellow>>& b){
+        return a.first < b.first;
     });
-    thd.detach();
+    if (quiet.size() > (size_t)kMaxProbesPerRound)
+        quiet.resize(kMaxProbesPerRound);
+
+    //记下探测时间，存活检查一个探测间隔内不再对同一好友重复探测
+    {
+        lock_guard<mutex> guard(mLivenessLock);
+        for (auto& entry : quiet)
+        {
+            auto state = mLiveness.find(entry.second->getIp());
+            if (state != mLiveness.end())
+                state->second.lastProbe = now;
+        }
+    }
+
+    SendImOnLine imOnLine(mName);
+    for (auto& entry : quiet)
+    {
+        if (!mStarted)
+            break;
+        imOnLine.setUtf8(entry.second->supportsUtf8());
+        mCommu.send(entry.second->getIp(), imOnLine);
+    }
+}
+
+void FeiqEngine::onActivity(shared_ptr<Post> post)
+{
+    mModel.touch(post->from->getIp(), post->from->lastSeen());
+}
+
+void FeiqEngine::trackLiveness(const shared_ptr<Fellow> &fellow, bool probed)
+{
+    auto ip = fellow->getIp();
+    lock_guard<mutex> guard(mLivenessLock);
+    if (mLiveness.find(ip) != mLiveness.end())
+        return;//已在时间轮中，到期时按最新的活跃时间重新安排
+
+    //刚探测过的，等一个探测间隔再检查
+    auto now = Post::now().time_since_epoch().count();
+    auto& state = mLiveness[ip];
+    state.probes = probed ? 1 : 0;
+    state.lastProbe = probed ? now : 0;
+    auto due = probed ? now + kLivenessProbeGap
+                      : fellow->lastSeen() + kLivenessQuiet;
+    mLivenessWheel.schedule(ip, due);
+}
+
+//缓存中超过7天未见的好友不再恢复
+static const int64_t kFellowCacheMaxAge = 7LL * 24 * 3600 * 1000;
+
+void FeiqEngine::restoreFellows()
+{
+    if (mFellowCachePath.empty())
+        return;
+
+    auto now = Post::now().time_since_epoch().count();
+    auto fellows = mModel.loadFellows(mFellowCachePath, now, kFellowCacheMaxAge);
+
+    //先显示出来，再逐个单播探测；有回应的转为已确认，没有的由存活检查移除
+    SendImOnLine imOnLine(mName);
+    for (auto& fellow : fellows)
+    {
+        postFellowUpdate(fellow);
+        imOnLine.setUtf8(fellow->supportsUtf8());
+        mCommu.send(fellow->getIp(), imOnLine);
+        trackLiveness(fellow, true);
+    }
+}
+
+void FeiqEngine::livenessLoop()
+{
+    while (mStarted)
+    {
+        {
+            unique_lock<mutex> lock(mHousekeepLock);
+            if (mHousekeepCnd.wait_for(lock, seconds(1), [this]{return !mStarted;}))
+                break;
+        }
+
+        checkLiveness(Post::now().time_since_epoch().count());
+    }
+}
+
+void FeiqEngine::checkLiveness(int64_t now)
+{
+    vector<shared_ptr<Fellow>> toProbe;
+    vector<shared_ptr<Fellow>> expired;
+
+    {
+        lock_guard<mutex> guard(mLivenessLock);
+        for (auto& ip : mLivenessWheel.advance(now))
+        {
+            auto state = mLiveness.find(ip);
+            if (state == mLiveness.end())
+                continue;
+
+            auto fellow = mModel.findFirstFellowOf(ip);
+            if (fellow == nullptr || !fellow->isOnLine())
+            {
+                mLiveness.erase(state);//已下线（如收到下线包），不再跟踪
+                continue;
+            }
+
+            if (now - fellow->lastSeen() < kLivenessQuiet)
+            {
+                //期间有过数据往来，从最新的活跃时间重新计时
+                state->second.probes = 0;
+                mLivenessWheel.schedule(ip, fellow->lastSeen() + kLivenessQuiet);
+            }
+            else if (state->second.probes == 0 && now - state->second.lastProbe < kLivenessProbeGap)
+            {
+                //定期检测刚探测过，算作第一次，等它的回应
+                state->second.probes = 1;
+                mLivenessWheel.schedule(ip, state->second.lastProbe + kLivenessProbeGap);
+            }
+            else if (state->second.probes < kLivenessProbes)
+            {
+                ++state->second.probes;
+                state->second.lastProbe = now;
+                toProbe.push_back(fellow);
+                mLivenessWheel.schedule(ip, now + kLivenessProbeGap);
+            }
+            else
+            {
+                mLiveness.erase(state);
+                expired.push_back(fellow);
+            }
+        }
+    }
+
+    //网络操作和通知放在锁外
+    SendImOnLine imOnLine(mName);
+    for (auto& fellow : toProbe)
+    {
+        imOnLine.setUtf8(fellow->supportsUtf8());
+        mCommu.send(fellow->getIp(), imOnLine);
+    }
+
+    for (auto& fellow : expired)
+    {
+        fellow->setOnLine(false);
+        mModel.syncOnline(fellow);
+        postFellowUpdate(fellow);
+    }
 }
 
+pair<uint64_t, uint64_t> FeiqEngine::getDedupStats() const
+{
+    return mCommu.dedupStats();
+}
 
 FeiqModel &FeiqEngine::getModel()
 {
@@ -731,12 +1433,86 @@ const FeiqModel &FeiqEngine::getModel() const
     return mModel;
 }
 
+void FeiqEngine::setImageDir(const string &dir, uint64_t maxBytes)
+{
+    mImageDir = dir;
+    mImageDirMaxBytes = maxBytes;
+    trimImageDir(0);
+}
+
+void FeiqEngine::trimImageDir(uint64_t incoming)
+{
+    if (mImageDir.empty())
+        return;
+
+    auto handle = opendir(mImageDir.c_str());
+    if (handle == nullptr)
+        return;
+
+    vector<tuple<time_t, uint64_t, string>> found;
+    uint64_t total = 0;
+    while (auto entry = readdir(handle))
+    {
+        auto path = mImageDir + "/" + entry->d_name;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            continue;
+
+        found.emplace_back(info.st_mtime, info.st_size, path);
+        total += info.st_size;
+    }
+    closedir(handle);
+
+    if (total + incoming <= mImageDirMaxBytes)
+        return;
+
+    //界面已把显示过的图片读进内存，删掉只影响以后重新打开的聊天记录
+    sort(found.begin(), found.end());
+    for (auto& item : found)
+    {
+        if (total + incoming <= mImageDirMaxBytes)
+            break;
+        if (unlink(get<2>(item).c_str()) == 0)
+            total -= get<1>(item);
+    }
+}
+
+void FeiqEngine::onAnsEntry(shared_ptr<Post> post)
+{
+    //上线/应答包才能确定对方能力，据此允许降级（例如对方换回了旧版飞秋）
+    post->from->setUtf8(post->isUtf8() || IS_OPT_SET(post->cmdId, IPMSG_CAPUTF8OPT));
+    post->from->setKyLink(IS_OPT_SET(post->cmdId, IPMSG_KYLINKOPT));
+    post->from->setCompression(IS_OPT_SET(post->cmdId, IPMSG_KYLINKOPT) && IS_OPT_SET(post->cmdId, IPMSG_COMPRESSOPT));
+}
+
 void FeiqEngine::onBrEntry(shared_ptr<Post> post)
 {
+    onAnsEntry(post);
+
     AnsBrEntry ans(mName);
+    ans.setUtf8(post->from->supportsUtf8());
     mCommu.send(post->from->getIp(), ans);
 }
 
+//自动下载的内嵌图片上限，超过的当作普通文件
+static const int kMaxInlineImageSize = 16*1024*1024;
+
+//只取文件名的扩展名（含点），保存路径由我们决定，不用对方给的文件名
+static string extensionOf(const string& filename)
+{
+    auto dot = filename.find_last_of('.');
+    if (dot == string::npos || filename.size() - dot > 8)
+        return "";
+
+    auto ext = filename.substr(dot);
+    for (auto ch : ext)
+    {
+        if (ch != '.' && !isalnum(static_cast<unsigned char>(ch)))
+            return "";
+    }
+    return ext;
+}
+
 void FeiqEngine::onMsg(shared_ptr<Post> post)
 {
     static vector<string> rejectedImages;
@@ -749,6 +1525,7 @@ void FeiqEngine::onMsg(shared_ptr<Post> post)
     auto end = post->contents.end();
 
     string reply;
+    list<shared_ptr<FileTask>> inlineImages;//内嵌图片，消息交给界面后自动下载
     while (it != end)//过滤消息内容：删除不支持的包，并回复好友
     {
         bool rejected = false;
@@ -756,8 +1533,21 @@ void FeiqEngine::onMsg(shared_ptr<Post> post)
         {
             auto fc = static_pointer_cast<FileContent>(*it);
 
+            //过大的或没有地方存放的内嵌图片，退化为普通文件由用户决定是否接收
+            if (fc->inlineImage && (mImageDir.empty() || fc->size > kMaxInlineImageSize))
+                fc->inlineImage = false;
+
             if (fc->fileType == IPMSG_FILE_REGULAR)//TODO:与飞秋的文件夹传输协议还没支持
-                mModel.addDownloadTask(event->fellow, fc);
+            {
+                auto task = mModel.addDownloadTask(event->fellow, fc);
+                if (fc->inlineImage)
+                {
+                    //包序号各自从启动时间起算，不同好友会重复，文件名带上对方ip
+                    fc->path = mImageDir + "/" + event->fellow->getIp() + "-" + to_string(fc->packetNo)
+                            + "-" + to_string(fc->fileId) + extensionOf(fc->filename);
+                    inlineImages.push_back(task);
+                }
+            }
             else if (fc->fileType == IPMSG_FILE_DIR)
             {
                 rejected=true;
@@ -799,11 +1589,25 @@ void FeiqEngine::onMsg(shared_ptr<Post> post)
         TextContent content;
         content.text = reply;
         send.setContent(&content);
+        send.setUtf8(post->from->supportsUtf8());
+        send.setFragmentable(post->from->isKyLink());
+        send.setKyLink(post->from->isKyLink());
         mCommu.send(post->from->getIp(), send);
     }
 
     if (!event->contents.empty())
         mMsgThd.sendMessage(event);
+
+    if (!inlineImages.empty())
+    {
+        uint64_t incoming = 0;
+        for (auto& task : inlineImages)
+            incoming += task->getContent()->size;
+        trimImageDir(incoming);
+    }
+
+    for (auto& task : inlineImages)
+        downloadFile(task.get());
 }
 
 void FeiqEngine::onSendCheck(shared_ptr<Post> post)
@@ -820,10 +1624,37 @@ void FeiqEngine::onReadCheck(shared_ptr<Post> post)
 
 void FeiqEngine::onSendTimeo(IdType packetId, const string& ip, shared_ptr<Content> content)
 {
+    shared_ptr<Fellow> fellow;
+    {
+        lock_guard<mutex> guard(mReliableLock);
+        auto found = mReliable.find(ip);
+        if (found == mReliable.end())
+            return;
+
+        auto& window = found->second;
+        auto it = std::find_if(window.inFlight.begin(), window.inFlight.end(),
+                               [packetId](const OutgoingMsg& msg){return msg.packetNo == packetId;});
+        if (it == window.inFlight.end())
+            return;//已确认
+
+        //指数退避重发
+        if (it->retries < kMaxRetransmit)
+        {
+            ++it->retries;
+            it->timeo *= 2;
+            if (transmit(*it).first)
+                return;
+        }
+
+        fellow = it->fellow;
+        window.inFlight.erase(it);
+        pumpPending(window);
+    }
+
     auto event = make_shared<SendTimeoEvent>();
     event->fellow = mModel.findFirstFellowOf(ip);
     if (event->fellow == nullptr)
-        return;
+        event->fellow = fellow;
 
     event->content = content;
     mMsgThd.sendMessage(event);
@@ -835,68 +1666,114 @@ void FeiqEngine::onReadMessage(shared_ptr<Post> post)
         return;
     auto content = dynamic_pointer_cast<IdContent>(post->contents[0]);
     mAsyncWait.clearWaitPack(content->id);
+
+    lock_guard<mutex> guard(mReliableLock);
+    auto found = mReliable.find(post->from->getIp());
+    if (found == mReliable.end())
+        return;
+
+    auto& window = found->second;
+    window.inFlight.remove_if([&content](const OutgoingMsg& msg){return msg.packetNo == content->id;});
+    pumpPending(window);
 }
 
-void FeiqEngine::fileServerHandler(unique_ptr<TcpSocket> client, int packetNo, int fileId, int offset)
+void FeiqEngine::onReleaseFiles(shared_ptr<Post> post)
 {
-    auto task = mModel.findTask(packetNo, fileId);
-    if (task == nullptr)
+    if (post->contents.empty())
         return;
+    auto packetNo = dynamic_pointer_cast<IdContent>(post->contents[0])->id;
+    auto ip = post->from->getIp();
 
-    auto func = [task, offset](unique_ptr<TcpSocket> client){
-        FILE* is = fopen(task->getContent()->path.c_str(), "r");
-        if (is == nullptr)
+    auto tasks = mModel.searchTask([packetNo, &ip](const FileTask& task){
+        return task.type() == FileTaskType::Upload
+                && task.getContent()->packetNo == packetNo
+                && task.fellow()->getIp() == ip;
+    });
+    for (auto& task : tasks)
+    {
+        if (task->getState() == FileTaskState::NotStart)
         {
-            task->setState(FileTaskState::Error, "无法读取文件");
+            task->setProcess(task->getContent()->size);
+            task->setState(FileTaskState::Finish, "对方本地已有相同文件");
         }
+    }
+}
 
-//        Defer{
-//            [is](){
-//                fclose(is);
-//            }
-//        };
+bool FeiqEngine::fileServerHandler(TcpSocket &client, int packetNo, int fileId, int offset, bool compress)
+{
+    auto task = mModel.findTask(packetNo, fileId);
+    if (task == nullptr)
+        return false;
 
-        if (offset > 0)
-            fseek(is, offset, SEEK_SET);
+    FILE* is = fopen(task->getContent()->path.c_str(), "r");
+    if (is == nullptr)
+    {
+        task->setState(FileTaskState::Error, "无法读取文件");
+        return false;
+    }
 
-        const int unitSize = 2048;//一次发送2k
-        std::array<char, unitSize> buf;
-        auto total = task->getContent()->size;
-        int sent = 0;
+    if (offset > 0)
+        fseek(is, offset, SEEK_SET);
 
-        task->setState(FileTaskState::Running);
-        while (sent < total && !feof(is))
-        {
-            auto left = total - sent;
-            auto request = unitSize > left ? left : unitSize;
-            int got = fread(buf.data(), 1, request, is);
-            got = client->send(buf.data(), got);
-            if (got < 0)
-            {
-                task->setState(FileTaskState::Error, "无法发送数据，可能是网络问题");
-                fclose(is);
-                return;
-            }
+    const int unitSize = 64*1024;//一次发送64k
+    vector<char> buf(unitSize);
+    auto total = task->getContent()->size;
+    int sent = 0;
 
-            sent+=got;
-            task->setProcess(sent);
-        }
+    //分块格式：每块独立决定是否压缩，已压缩的文件直接原样分块
+    unique_ptr<TransferCodec> codec;
+    vector<char> frame;
+    if (compress)
+        codec.reset(new TransferCodec(TransferCodec::canCompress()
+                                      && !TransferCodec::isPrecompressed(task->getContent()->filename)));
 
-        if (sent != total)
+    //文件内容攒满整段再发，发完取消cork把尾巴推出去
+    client.setCork(true);
+    Defer uncork{[&client](){client.setCork(false);}};
+
+    task->setState(FileTaskState::Running);
+    while (sent < total && !feof(is))
+    {
+        auto left = total - sent;
+        auto request = unitSize > left ? left : unitSize;
+        int got = fread(buf.data(), 1, request, is);
+        if (got <= 0)
+            break;
+
+        if (codec)
         {
-            task->setState(FileTaskState::Error, "文件未完整发送，可能是发送期间文件被改动");
+            frame.clear();
+            codec->encode(buf.data(), got, frame);
+            if (client.send(frame.data(), frame.size()) < 0)
+                got = -1;
         }
         else
         {
-            task->setProcess(total);
-            task->setState(FileTaskState::Finish);
+            got = client.send(buf.data(), got);
         }
 
-        fclose(is);
-    };
+        if (got < 0)
+        {
+            task->setState(FileTaskState::Error, "无法发送数据，可能是网络问题");
+            fclose(is);
+            return false;
+        }
 
-    thread thd(func, std::move(client));
-    thd.detach();
+        sent+=got;
+        task->setProcess(sent);
+    }
+
+    fclose(is);
+
+    if (sent != total)
+    {
+        task->setState(FileTaskState::Error, "文件未完整发送，可能是发送期间文件被改动");
+        return false;
+    }
+
+    task->setProcess(total);
+    task->setState(FileTaskState::Finish);
+    return true;
 }
 
 shared_ptr<Fellow> FeiqEngine::addOrUpdateFellow(shared_ptr<Fellow> fellow)
@@ -917,16 +1794,26 @@ shared_ptr<Fellow> FeiqEngine::addOrUpdateFellow(shared_ptr<Fellow> fellow)
     }
 
     if (shouldApdate){
-        auto event = make_shared<FellowViewEvent>();
-        event->what = ViewEventType::FELLOW_UPDATE;
-        event->fellow = f;
-        event->when = Post::now();
-        mMsgThd.sendMessage(event);
+        ++mFellowEpoch;
+        mModel.syncOnline(f);
+        postFellowUpdate(f);
     }
 
+    if (f->isOnLine())
+        trackLiveness(f);
+
     return f;
 }
 
+void FeiqEngine::postFellowUpdate(shared_ptr<Fellow> fellow)
+{
+    auto event = make_shared<FellowViewEvent>();
+    event->what = ViewEventType::FELLOW_UPDATE;
+    event->fellow = fellow;
+    event->when = Post::now();
+    mMsgThd.sendMessage(event);
+}
+
 void FeiqEngine::dispatchMsg(shared_ptr<ViewEvent> msg)
 {
     mView->onEvent(msg);
@@ -939,6 +1826,20 @@ void FeiqEngine::broadcastToCurstomGroup(SendProtocol &protocol)
         if (!mStarted)
             break;//发送过程是一个耗时网络操作，如果已经stop，则中断
 
+        //本机网卡的子网广播已由全局广播按网卡发过，不重复发
+        if (mCommu.isLocalBroadcast(ip))
+            continue;
+
         mCommu.send(ip, protocol);
     }
 }
+
+void FeiqEngine::announce(SendProtocol &protocol, bool sweep)
+{
+    mCommu.send("255.255.255.255", protocol);
+    auto group = multicastGroup();
+    if (!group.empty())
+        mCommu.send(group, protocol);
+    if (sweep)
+        broadcastToCurstomGroup(protocol);
+}
@@ -6,11 +6,17 @@
 #include <string>
 #include <tuple>
 #include <list>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 #include <unordered_map>
 #include "feiqmodel.h"
 #include "msgqueuethread.h"
 #include "ifeiqview.h"
 #include "asynwait.h"
+#include "timerwheel.h"
+#include "blobstore.h"
 using namespace std;
 
 class Post;
@@ -40,11 +46,40 @@ public:
     void sendImOnLine(const string& ip = "");
     /**
      * @brief enableIntervalDetect 当接入路由，被禁止发送广播包时，
-     * 启用间隔检测可每隔一段时间发送一次上线通知到指定网段，以实现检测。
+     * 启用间隔检测可定期发送上线通知到指定网段，以实现检测。
+     * seconds为基础间隔：好友列表稳定时间隔逐步加倍（上限为其8倍），有变化时恢复；
+     * 每次间隔带±20%抖动，避免多台机器同步广播。
+     * 久未收到数据的好友会被单播探测，近期有数据往来的则不打扰。
      */
     void enableIntervalDetect(int seconds);
+    /**
+     * @brief enableMulticastDiscovery 上线/下线通知额外发往组播组，可跨路由发现好友，
+     * 定期检测时只发一个组播包，不再逐个发往自定义网段
+     * @param group 组播地址，如239.255.24.25
+     * @param ttl 组播跳数
+     */
+    pair<bool, string> enableMulticastDiscovery(const string& group, int ttl);
+    /**
+     * @brief setFellowCachePath 好友快照文件，启动时恢复、停止时保存；为空则不缓存
+     */
+    void setFellowCachePath(const string& path){mFellowCachePath = path;}
+    /**
+     * @brief setBlobStore 收到的文件按内容缓存到dir，KyLink好友再发来相同内容时直接复制，不再下载
+     * @param maxBytes 缓存总大小上限，超出时淘汰最久未用的
+     * @return 目录是否可用
+     */
+    bool setBlobStore(const string& dir, uint64_t maxBytes){return mBlobs.open(dir, maxBytes);}
+    /**
+     * @brief setImageDir 好友发来的内嵌图片自动下载到dir；为空则当作普通文件，由用户决定是否接收
+     * @param maxBytes 目录总大小上限，超出时删除最早的图片
+     */
+    void setImageDir(const string& dir, uint64_t maxBytes);
 
 public:
+    /**
+     * @brief getDedupStats 接收去重的统计：查询次数，丢弃的重复包数
+     */
+    pair<uint64_t, uint64_t> getDedupStats() const;
     FeiqModel &getModel();
     const FeiqModel &getModel() const;
 
@@ -54,17 +89,81 @@ private://trigers
     void onBrExit(shared_ptr<Post> post);
     void onMsg(shared_ptr<Post> post);
     void onSendCheck(shared_ptr<Post> post);
+    void trimImageDir(uint64_t incoming);//删除最早的图片，直到加上incoming也不超过上限
     void onReadCheck(shared_ptr<Post> post);
     void onSendTimeo(IdType packetId, const string &ip, shared_ptr<Content> content);
     void onReadMessage(shared_ptr<Post> post);
+    void onReleaseFiles(shared_ptr<Post> post);
 
 private:
-    void fileServerHandler(unique_ptr<TcpSocket> client, int packetNo, int fileId, int offset);
+    bool fileServerHandler(TcpSocket& client, int packetNo, int fileId, int offset, bool compress);
+    /**
+     * @brief receiveFile 从连接上收一个文件
+     * @param framed 是否已请求分块格式（见TransferCodec）
+     */
+    bool receiveFile(TcpSocket& client, FileTask* task, bool framed);
+    void drainDownloads(string ip);
+    bool fetchFromBlobs(FileTask* task);
+    void storeToBlobs(FileTask* task);
+
+private:
+    /**
+     * @brief The OutgoingMsg struct 一条等待对方回执(IPMSG_RECVMSG)的消息
+     */
+    struct OutgoingMsg
+    {
+        shared_ptr<Fellow> fellow;
+        shared_ptr<Content> content;
+        IdType packetNo=0;//首次发送后确定，重发沿用
+        int retries=0;
+        int timeo=0;//本次等待回执的超时（毫秒），每次重发翻倍
+    };
+
+    /**
+     * @brief The ReliableWindow struct 每个好友的发送窗口：在途消息数有上限，超出的排队
+     */
+    struct ReliableWindow
+    {
+        list<OutgoingMsg> inFlight;
+        list<OutgoingMsg> pending;
+    };
+
+    pair<bool, string> sendReliable(shared_ptr<Fellow> fellow, shared_ptr<Content> content);
+    pair<bool, string> transmit(OutgoingMsg& msg);
+    void pumpPending(ReliableWindow& window);
+    pair<bool, string> sendContent(shared_ptr<Fellow> fellow, shared_ptr<Content> content);
+    void hashAndSend(shared_ptr<OutgoingMsg> msg);
+    void onDuplicate(shared_ptr<Post> post);
+    void onActivity(shared_ptr<Post> post);
+
+private:
+    /**
+     * @brief The Liveness struct 一个在线好友的存活检查进度
+     */
+    struct Liveness
+    {
+        int probes=0;//已经发出的探测次数
+        int64_t lastProbe=0;//最近一次单播探测的时间，含定期检测发出的
+    };
+
+    void trackLiveness(const shared_ptr<Fellow>& fellow, bool probed = false);
+    void restoreFellows();
+    void livenessLoop();
+    void checkLiveness(int64_t now);
 
 private:
     shared_ptr<Fellow> addOrUpdateFellow(shared_ptr<Fellow> fellow);
     void dispatchMsg(shared_ptr<ViewEvent> msg);
     void broadcastToCurstomGroup(SendProtocol& protocol);
+    /**
+     * @brief announce 全局广播（按本机网卡逐个发子网广播），发往组播组和自定义网段
+     * @param sweep 是否逐个发往自定义网段；启用组播后定期检测可省去
+     */
+    void announce(SendProtocol& protocol, bool sweep = true);
+    string multicastGroup();
+    void presenceLoop();
+    void postFellowUpdate(shared_ptr<Fellow> fellow);
+    void probeQuietFellows(int64_t quietMs);
 
 private:
     FeiqCommu mCommu;
@@ -73,10 +172,31 @@ private:
     string mHost;
     string mName;
     MsgQueueThread<ViewEvent> mMsgThd;
+    MsgQueueThread<OutgoingMsg> mHashThd;//发给KyLink好友的文件先在此算摘要，再发出通知
     IFeiqView* mView;
     vector<string> mBroadcast;
-    bool mStarted=false;
+    string mFellowCachePath;
+    BlobStore mBlobs;//收到的文件，按内容寻址
+    string mImageDir;
+    uint64_t mImageDirMaxBytes=0;
+    string mMulticastGroup;//为空表示未启用组播发现
+    mutex mMulticastLock;
+    atomic<bool> mStarted{false};
     AsynWait mAsyncWait;//异步等待对方回包
+    thread mPresenceThd;//间隔检测线程
+    thread mLivenessThd;//存活检查线程
+    mutex mHousekeepLock;//后台线程等待/退出用
+    condition_variable mHousekeepCnd;
+    TimerWheel mLivenessWheel;//好友下次检查的时间
+    unordered_map<string, Liveness> mLiveness;//ip -> 检查进度，有条目即已在时间轮中
+    mutex mLivenessLock;
+    atomic<int> mPresenceInterval{0};//间隔检测的基础间隔（秒）
+    atomic<unsigned> mFellowEpoch{0};//好友列表每次变化加一，用于判断网络是否稳定
+    atomic<int64_t> mLastAnnounce{0};//最近一次广播上线通知的时间（毫秒）
+    unordered_map<string, ReliableWindow> mReliable;//ip -> 发送窗口
+    mutex mReliableLock;
+    unordered_map<string, list<FileTask*>> mDownloads;//ip -> 等待下载的文件，KyLink好友在一条连接上依次下载
+    mutex mDownloadLock;
 
     struct EnumClassHash
     {
@@ -88,6 +208,7 @@ private:
     };
     //可以用unique_ptr，但是unique_ptr要求知道具体定义
     unordered_map<ContentType, shared_ptr<ContentSender>, EnumClassHash> mContentSender;
+    mutex mContentSenderLock;//调用方线程与摘要线程共用mContentSender
 };
 
 #endif // FEIQENGINE_H
@@ -1,5 +1,13 @@
 #include "feiqmodel.h"
 #include <functional>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include "parcelable.h"
+
+//快照文件格式：标记、版本、好友数，之后是每个好友的Parcel
+static const char* kFellowCacheMagic = "KYFC";
+static const int kFellowCacheVersion = 1;
 
 FeiqModel::FeiqModel()
 {
@@ -10,6 +18,8 @@ void FeiqModel::addFellow(shared_ptr<Fellow> fellow)
 {
     lock_guard<mutex> guard(mFellowLock);
     mFellows.push_back(fellow);
+    mIpIndex.emplace(fellow->getIp(), fellow);
+    syncOnlineLocked(fellow);
 }
 
 shared_ptr<Fellow> FeiqModel::getFullInfoOf(shared_ptr<Fellow> fellow)
@@ -23,9 +33,8 @@ shared_ptr<Fellow> FeiqModel::getFullInfoOf(shared_ptr<Fellow> fellow)
 shared_ptr<Fellow> FeiqModel::findFirstFellowOf(const string &ip)
 {
     lock_guard<mutex> guard(mFellowLock);
-    auto predict = [&ip](shared_ptr<Fellow> tmp){return tmp->getIp() == ip;};
-    auto found = std::find_if(mFellows.begin(), mFellows.end(), predict);
-    return found == mFellows.end() ? nullptr : *found;
+    auto found = mIpIndex.find(ip);
+    return found == mIpIndex.end() ? nullptr : found->second;
 }
 
 list<shared_ptr<Fellow> > FeiqModel::searchFellow(const string &text) const
@@ -65,6 +74,139 @@ shared_ptr<Fellow> FeiqModel::getShared(const Fellow *fellow)
     return nullptr;
 }
 
+void FeiqModel::touch(const string &ip, int64_t when)
+{
+    lock_guard<mutex> guard(mFellowLock);
+    auto found = mIpIndex.find(ip);
+    if (found != mIpIndex.end() && found->second->lastSeen() < when)
+        found->second->setLastSeen(when);
+}
+
+void FeiqModel::syncOnline(shared_ptr<Fellow> fellow)
+{
+    if (fellow == nullptr)
+        return;
+
+    lock_guard<mutex> guard(mFellowLock);
+    syncOnlineLocked(fellow);
+}
+
+vector<shared_ptr<Fellow> > FeiqModel::onlineFellows() const
+{
+    lock_guard<mutex> guard(mFellowLock);
+    return mOnline;
+}
+
+bool FeiqModel::saveFellows(const string &path) const
+{
+    Parcel parcel;
+    {
+        lock_guard<mutex> guard(mFellowLock);
+        parcel.writeString(kFellowCacheMagic);
+        parcel.write(kFellowCacheVersion);
+        parcel.write(static_cast<int>(mFellows.size()));
+        for (auto& fellow : mFellows)
+            fellow->writeTo(parcel);
+    }
+
+    //先写临时文件再改名，中途退出不会留下半个快照
+    auto tmp = path + ".tmp";
+    {
+        ofstream os(tmp, ios_base::binary | ios_base::trunc);
+        if (!os.is_open())
+            return false;
+
+        auto raw = parcel.raw();
+        os.write(raw.data(), raw.size());
+        if (!os.good())
+            return false;
+    }
+
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+list<shared_ptr<Fellow> > FeiqModel::loadFellows(const string &path, int64_t now, int64_t maxAge)
+{
+    list<shared_ptr<Fellow>> loaded;
+
+    ifstream is(path, ios_base::binary);
+    if (!is.is_open())
+        return loaded;
+
+    vector<char> raw((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+    Parcel parcel;
+    parcel.fillWith(raw.data(), raw.size());
+    parcel.resetForRead();
+
+    try
+    {
+        string magic;
+        int version = 0;
+        int count = 0;
+        parcel.readString(magic);
+        parcel.read(version);
+        parcel.read(count);
+        if (magic != kFellowCacheMagic || version != kFellowCacheVersion)
+            return loaded;
+
+        for (int i = 0; i < count; i++)
+        {
+            auto fellow = make_shared<Fellow>();
+            fellow->readFrom(parcel);
+            if (fellow->getIp().empty() || now - fellow->lastSeen() > maxAge)
+                continue;
+
+            fellow->setOnLine(true);
+            fellow->setVerified(false);
+            loaded.push_back(fellow);
+        }
+    }
+    catch (...)
+    {
+        //快照损坏时，已读出的部分仍可用
+    }
+
+    lock_guard<mutex> guard(mFellowLock);
+    for (auto it = loaded.begin(); it != loaded.end();)
+    {
+        if (mIpIndex.find((*it)->getIp()) != mIpIndex.end())
+        {
+            it = loaded.erase(it);
+            continue;
+        }
+
+        mFellows.push_back(*it);
+        mIpIndex.emplace((*it)->getIp(), *it);
+        syncOnlineLocked(*it);
+        ++it;
+    }
+
+    return loaded;
+}
+
+void FeiqModel::syncOnlineLocked(const shared_ptr<Fellow> &fellow)
+{
+    auto found = mOnlinePos.find(fellow.get());
+    bool inSet = found != mOnlinePos.end();
+
+    if (fellow->isOnLine() && !inSet)
+    {
+        mOnlinePos[fellow.get()] = mOnline.size();
+        mOnline.push_back(fellow);
+    }
+    else if (!fellow->isOnLine() && inSet)
+    {
+        auto pos = found->second;
+        mOnlinePos.erase(found);
+        if (pos != mOnline.size() - 1)
+        {
+            mOnline[pos] = mOnline.back();
+            mOnlinePos[mOnline[pos].get()] = pos;
+        }
+        mOnline.pop_back();
+    }
+}
+
 shared_ptr<FileTask> FeiqModel::addDownloadTask(shared_ptr<Fellow> fellow, shared_ptr<FileContent> fileContent)
 {
     lock_guard<mutex> guard(mFileTaskLock);
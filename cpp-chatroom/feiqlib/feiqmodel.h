@@ -4,7 +4,9 @@
 #include "fellow.h"
 #include <memory>
 #include <list>
+#include <vector>
 #include <mutex>
+#include <unordered_map>
 #include "filetask.h"
 #include "uniqueid.h"
 using namespace std;
@@ -21,6 +23,33 @@ public:
     list<shared_ptr<Fellow>> searchFellow(const string& text) const;
     shared_ptr<Fellow> getShared(const Fellow* fellow);
 
+public:
+    /**
+     * @brief touch 刷新好友的活跃时间，每个包都会调用，只查ip索引
+     */
+    void touch(const string& ip, int64_t when);
+    /**
+     * @brief syncOnline 好友在线状态变化后调用，同步在线集合
+     */
+    void syncOnline(shared_ptr<Fellow> fellow);
+    /**
+     * @brief onlineFellows 在线好友，不必遍历已离线的
+     */
+    vector<shared_ptr<Fellow>> onlineFellows() const;
+
+public:
+    /**
+     * @brief saveFellows 把好友资料写入快照文件，下次启动时可立即显示
+     * @return 是否写入成功
+     */
+    bool saveFellows(const string& path) const;
+    /**
+     * @brief loadFellows 从快照恢复好友，恢复的好友标记为在线但未确认，已存在的ip跳过
+     * @param maxAge 超过此时长（毫秒）未见的好友不再恢复
+     * @return 新恢复的好友
+     */
+    list<shared_ptr<Fellow>> loadFellows(const string& path, int64_t now, int64_t maxAge);
+
 public:
     shared_ptr<FileTask> addDownloadTask(shared_ptr<Fellow> fellow, shared_ptr<FileContent> fileContent);
     shared_ptr<FileTask> addUploadTask(shared_ptr<Fellow> fellow, shared_ptr<FileContent> fileContent);
@@ -28,8 +57,14 @@ public:
     list<shared_ptr<FileTask>> searchTask(function<bool(const FileTask&)> predict) const;
     void removeFileTask(function<bool (const FileTask&)> predict);
 
+private:
+    void syncOnlineLocked(const shared_ptr<Fellow>& fellow);
+
 private:
     list<shared_ptr<Fellow>> mFellows;
+    unordered_map<string, shared_ptr<Fellow>> mIpIndex;//ip -> 该ip的第一个好友
+    vector<shared_ptr<Fellow>> mOnline;//在线集合，删除时与末尾交换
+    unordered_map<const Fellow*, size_t> mOnlinePos;//好友在mOnline中的下标
     list<shared_ptr<FileTask>> mFileTasks;
     mutable mutex mFellowLock;
     mutable mutex mFileTaskLock;
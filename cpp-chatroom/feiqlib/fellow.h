@@ -4,9 +4,12 @@
 #include <string>
 #include <memory>
 #include <sstream>
+#include <atomic>
+#include <cstdint>
+#include "parcelable.h"
 using namespace std;
 
-class Fellow
+class Fellow : public Parcelable
 {
 public:
     string getIp() const{return mIp;}
@@ -15,6 +18,18 @@ public:
     string getMac() const{return mMac;}
     bool isOnLine() const{return mOnLine;}
     string version() const{return mVersion;}
+    bool supportsUtf8() const{return mUtf8;}
+    bool isKyLink() const{return mKyLink;}
+    bool supportsCompression() const{return mCompression;}
+    /**
+     * @brief lastSeen 最近一次收到对方数据包的时间（毫秒，system_clock）
+     * 接收线程随时更新，其他线程读取时可能已变化
+     */
+    int64_t lastSeen() const{return mLastSeen.load(memory_order_relaxed);}
+    /**
+     * @brief isVerified 本次运行中是否收到过对方的包；从缓存恢复的好友在收到回应前为false
+     */
+    bool isVerified() const{return mVerified;}
 
     void setIp(const string& value){
         mIp = value;
@@ -44,6 +59,26 @@ public:
         mPcName = value;
     }
 
+    void setUtf8(bool value){
+        mUtf8 = value;
+    }
+
+    void setKyLink(bool value){
+        mKyLink = value;
+    }
+
+    void setCompression(bool value){
+        mCompression = value;
+    }
+
+    void setLastSeen(int64_t value){
+        mLastSeen.store(value, memory_order_relaxed);
+    }
+
+    void setVerified(bool value){
+        mVerified = value;
+    }
+
     bool update(const Fellow& fellow)
     {
         bool changed = false;
@@ -63,6 +98,23 @@ public:
             changed=true;
         }
 
+        //普通包不带能力位，只升级不降级；降级由上线/应答包决定
+        if (fellow.mUtf8)
+            mUtf8 = true;
+        if (fellow.mKyLink)
+            mKyLink = true;
+        if (fellow.mCompression)
+            mCompression = true;
+
+        if (fellow.mVerified && !mVerified){
+            mVerified = true;
+            changed=true;
+        }
+
+        //活跃时间只用于探测调度，不算作资料变化，不通知界面
+        if (fellow.lastSeen() > lastSeen())
+            setLastSeen(fellow.lastSeen());
+
         return changed;
     }
 
@@ -87,18 +139,57 @@ public:
         <<",mac="<<mMac
         <<",online="<<mOnLine
         <<",version="<<mVersion
+        <<",utf8="<<mUtf8
+        <<",kylink="<<mKyLink
+        <<",compression="<<mCompression
+        <<",verified="<<mVerified
         <<"]";
         return os.str();
     }
 
+public:
+    //缓存只保存对方的资料，在线状态与是否已确认不落盘
+    virtual void writeTo(Parcel& out) const override
+    {
+        out.writeString(mIp);
+        out.writeString(mPcName);
+        out.writeString(mName);
+        out.writeString(mHost);
+        out.writeString(mMac);
+        out.writeString(mVersion);
+        out.write(lastSeen());
+        out.write(mUtf8);
+        out.write(mKyLink);
+    }
+
+    virtual void readFrom(Parcel& in) override
+    {
+        in.readString(mIp);
+        in.readString(mPcName);
+        in.readString(mName);
+        in.readString(mHost);
+        in.readString(mMac);
+        in.readString(mVersion);
+        int64_t lastSeen = 0;
+        in.read(lastSeen);
+        setLastSeen(lastSeen);
+        in.read(mUtf8);
+        in.read(mKyLink);
+    }
+
 private:
     string mIp;
     string mPcName;
     string mName;
     string mHost;
     string mMac;
-    bool mOnLine;
+    bool mOnLine=false;
     string mVersion;
+    bool mUtf8=false;
+    bool mKyLink=false;
+    bool mCompression=false;
+    atomic<int64_t> mLastSeen{0};
+    bool mVerified=true;
 };
 
 #endif // FELLOW_H
@@ -0,0 +1,88 @@
+#include "fragmentassembler.h"
+#include <chrono>
+
+using namespace std::chrono;
+
+FragmentAssembler::FragmentAssembler(size_t maxMessageSize, size_t maxTotalSize, int msTimeout)
+    :mMaxMessageSize(maxMessageSize), mMaxTotalSize(maxTotalSize), mTimeout(msTimeout)
+{
+}
+
+bool FragmentAssembler::add(const string &ip, IdType packetNo, int index, int total,
+                            const char *data, size_t size, vector<char> &out)
+{
+    if (total <= 0 || index < 0 || index >= total || size > KYLINK_FRAGMENT_PAYLOAD)
+        return false;
+    if (static_cast<size_t>(total) * KYLINK_FRAGMENT_PAYLOAD > mMaxMessageSize)
+        return false;
+
+    auto now = duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+
+    lock_guard<mutex> guard(mLock);
+    dropExpired(now);
+
+    auto key = make_pair(ip, packetNo);
+    auto it = mPending.find(key);
+    if (it == mPending.end())
+    {
+        Pending pending;
+        pending.parts.resize(total);
+        pending.got.resize(total);
+        pending.expire = now + mTimeout;
+        it = mPending.emplace(key, std::move(pending)).first;
+    }
+
+    auto& pending = it->second;
+    if (static_cast<int>(pending.parts.size()) != total || pending.got[index])
+        return false;//分片总数不一致或重复分片
+
+    pending.parts[index].assign(data, data + size);
+    pending.got[index] = true;
+    pending.bytes += size;
+    mTotalBytes += size;
+    ++pending.received;
+
+    if (pending.received < total)
+    {
+        while (mTotalBytes > mMaxTotalSize && mPending.size() > 1)
+            dropOldest();
+        return false;
+    }
+
+    out.clear();
+    out.reserve(pending.bytes);
+    for (auto& part : pending.parts)
+        out.insert(out.end(), part.begin(), part.end());
+
+    erase(it);
+    return true;
+}
+
+void FragmentAssembler::dropExpired(int64_t now)
+{
+    for (auto it = mPending.begin(); it != mPending.end();)
+    {
+        auto cur = it++;
+        if (cur->second.expire <= now)
+            erase(cur);
+    }
+}
+
+void FragmentAssembler::dropOldest()
+{
+    auto oldest = mPending.begin();
+    for (auto it = mPending.begin(); it != mPending.end(); ++it)
+    {
+        if (it->second.expire < oldest->second.expire)
+            oldest = it;
+    }
+
+    if (oldest != mPending.end())
+        erase(oldest);
+}
+
+void FragmentAssembler::erase(map<Key, Pending>::iterator it)
+{
+    mTotalBytes -= it->second.bytes;
+    mPending.erase(it);
+}
@@ -0,0 +1,64 @@
+#ifndef FRAGMENTASSEMBLER_H
+#define FRAGMENTASSEMBLER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+#include "uniqueid.h"
+#include "ipmsg.h"
+using namespace std;
+
+/**
+ * @brief The FragmentAssembler class 重组KyLink好友发来的超长包分片（IPMSG_FRAGMENT）
+ * 内存有上限：单个原包不超过maxMessageSize，所有未完成的原包合计不超过maxTotalSize，
+ * 超出时丢弃最早的；超过时限仍未到齐的原包也会被丢弃。
+ */
+class FragmentAssembler
+{
+public:
+    FragmentAssembler(size_t maxMessageSize = KYLINK_MAX_MESSAGE_SIZE,
+                      size_t maxTotalSize = 4 * KYLINK_MAX_MESSAGE_SIZE,
+                      int msTimeout = 5000);
+
+public:
+    /**
+     * @brief add 收到一个分片
+     * @param ip 来源
+     * @param packetNo 原包序号
+     * @param index 分片序号（0开始）
+     * @param total 分片总数
+     * @param data 分片数据
+     * @param size 分片大小
+     * @param out 到齐时输出重组后的原包
+     * @return 是否已到齐
+     */
+    bool add(const string& ip, IdType packetNo, int index, int total,
+             const char* data, size_t size, vector<char>& out);
+
+private:
+    struct Pending
+    {
+        vector<vector<char>> parts;
+        vector<bool> got;//分片可以为空，是否收到另记
+        int received=0;
+        size_t bytes=0;
+        int64_t expire=0;
+    };
+    typedef pair<string, IdType> Key;
+
+    void dropExpired(int64_t now);
+    void dropOldest();
+    void erase(map<Key, Pending>::iterator it);
+
+private:
+    map<Key, Pending> mPending;
+    size_t mTotalBytes=0;
+    size_t mMaxMessageSize;
+    size_t mMaxTotalSize;
+    int mTimeout;
+    mutex mLock;
+};
+
+#endif // FRAGMENTASSEMBLER_H
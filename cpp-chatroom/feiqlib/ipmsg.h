@@ -50,7 +50,8 @@
 #define IPMSG_DIALUPOPT 0x00010000
 #define IPMSG_FILEATTACHOPT 0x00200000
 #define IPMSG_ENCRYPTOPT 0x00400000
-#define IPMSG_UTF8OPT 0x00800000
+#define IPMSG_UTF8OPT 0x00800000//本包以UTF-8编码
+#define IPMSG_CAPUTF8OPT 0x01000000//上线/应答包携带，表示支持UTF-8收发
 
     /*  option for send command  */
 #define IPMSG_SENDCHECKOPT 0x00000100
@@ -136,6 +137,27 @@
 #define IS_CMD_SET(cmd, test) (((cmd) & 0xFF) == test)
 #define IS_OPT_SET(cmd, opt) (((cmd) & opt) == opt)
 
+// ============================================================================
+// KyLink扩展协议 (仅在双方都是KyLink时使用，旧版飞秋忽略未知的选项位)
+// ============================================================================
+#define IPMSG_KYLINKOPT 0x40000000      // 上线/应答包携带，表示对方是KyLink，支持以下扩展
+
+// 超长包分片：附加区为 原包序号:分片序号:分片总数:本片长度: 后接原包的一段数据
+#define IPMSG_FRAGMENT      0x000000e8
+#define KYLINK_FRAGMENT_PAYLOAD 3072            // 单个分片携带的原包数据，加上包头仍小于MAX_RCV_SIZE
+#define KYLINK_MAX_MESSAGE_SIZE (256*1024)      // 可重组的最大原包
+
+// 文件连接复用：GETFILEDATA携带时，发完该文件后保持连接，等待同一连接上的下一个请求（可流水线发送多个请求）
+#define IPMSG_KEEPALIVEOPT  IPMSG_KYLINKOPT
+
+// 文件分块压缩：上线/应答包携带，表示文件服务支持分块传输格式；GETFILEDATA携带，请求以该格式发送（见TransferCodec）
+#define IPMSG_COMPRESSOPT   0x20000000
+
+// 文件扩展属性：内容的SHA-256（64位十六进制），接收方本地已有相同内容时直接复制，并以IPMSG_RELEASEFILES告知发送方
+#define IPMSG_FILE_KYHASH   0x00004b01
+// 文件扩展属性：值为1表示聊天中的内嵌图片，接收方自动下载并直接显示
+#define IPMSG_FILE_KYINLINE 0x00004b02
+
 // ============================================================================
 // 视频流扩展协议 (自定义扩展，不与标准飞秋协议冲突)
 // ============================================================================
@@ -149,9 +171,19 @@
 
 // 视频帧数据包魔数 (用于UDP 2426端口的帧数据)
 #define VIDEO_FRAME_MAGIC   0x56464551  // "VFEQ" (Video FeiQ)
+// 带帧元数据的分片头魔数，接收端同时接受两种分片
+#define VIDEO_FRAME_MAGIC_V2 0x32524656 // "VFR2"
+// 接收端发回推流端的重传请求魔数 (发往推流端的源端口)
+#define VIDEO_NACK_MAGIC    0x4b414e56  // "VNAK"
+// 接收端每秒发回的接收报告魔数，推流端据此调整码率
+#define VIDEO_REPORT_MAGIC  0x54505256  // "VRPT"
 
 // 视频帧分包参数
 #define VIDEO_MAX_CHUNK_SIZE 1400       // 单个UDP包最大载荷
 #define VIDEO_FRAME_TIMEOUT_MS 100      // 帧重组超时时间
 
+// 分片头版本和视频编码
+#define VIDEO_PROTOCOL_VERSION 2        // 当前的分片头版本，新字段只在末尾追加
+#define VIDEO_CODEC_JPEG    1           // 每帧一幅JPEG
+
 #endif // IPMSG_H
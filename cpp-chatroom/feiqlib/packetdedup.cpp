@@ -0,0 +1,60 @@
+#include "packetdedup.h"
+#include <chrono>
+
+using namespace std::chrono;
+
+static uint64_t splitmix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t mixKey(uint64_t host, IdType packetNo)
+{
+    //splitmix64，让相邻包序号散开到不同的槽；主机先单独打散，避免与包序号相消
+    auto x = splitmix(splitmix(host) ^ packetNo);
+    return x == 0 ? 1 : x;
+}
+
+PacketDedup::PacketDedup(int msTtl)
+    :mTtl(msTtl)
+{
+}
+
+bool PacketDedup::checkAndInsert(uint64_t host, IdType packetNo)
+{
+    ++mLookups;
+
+    auto key = mixKey(host, packetNo);
+    auto now = duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    auto index = key & (kCapacity - 1);
+
+    lock_guard<mutex> guard(mLock);
+    Slot* victim = nullptr;
+    for (size_t i = 0; i < kMaxProbe; ++i)
+    {
+        auto& slot = mSlots[(index + i) & (kCapacity - 1)];
+        if (slot.key == key && slot.expire > now)
+        {
+            ++mHits;
+            return true;
+        }
+
+        //优先复用空槽或已过期的槽，否则淘汰探测范围内最早过期的
+        if (slot.key == 0 || slot.expire <= now)
+        {
+            if (victim == nullptr || victim->expire > now)
+                victim = &slot;
+        }
+        else if (victim == nullptr || (victim->expire > now && slot.expire < victim->expire))
+        {
+            victim = &slot;
+        }
+    }
+
+    victim->key = key;
+    victim->expire = now + mTtl;
+    return false;
+}
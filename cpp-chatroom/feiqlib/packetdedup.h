@@ -0,0 +1,50 @@
+#ifndef PACKETDEDUP_H
+#define PACKETDEDUP_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "uniqueid.h"
+using namespace std;
+
+/**
+ * @brief The PacketDedup class 接收端去重缓存
+ * 对方带IPMSG_RETRYOPT重发、或多网卡主机的同一个包从多个地址到达时，同一(主机, 包序号)会收到多次。
+ * 以开放寻址哈希表记录最近见过的包，条目超过时限即失效；容量固定，运行期不做内存分配。
+ */
+class PacketDedup
+{
+public:
+    explicit PacketDedup(int msTtl = 30000);
+
+public:
+    /**
+     * @brief checkAndInsert 查询并记录一个包
+     * @param host 发送方主机的标识（MAC或主机名的哈希），与来源ip无关
+     * @param packetNo 包序号
+     * @return true 时限内已见过该包，应丢弃
+     */
+    bool checkAndInsert(uint64_t host, IdType packetNo);
+
+    uint64_t lookups() const{return mLookups;}
+    uint64_t hits() const{return mHits;}
+
+private:
+    static const size_t kCapacity = 1024;//必须是2的幂
+    static const size_t kMaxProbe = 16;
+
+    struct Slot
+    {
+        uint64_t key=0;//0表示空槽
+        int64_t expire=0;//过期时间（steady_clock毫秒）
+    };
+
+    array<Slot, kCapacity> mSlots;
+    mutex mLock;
+    int mTtl;
+    atomic<uint64_t> mLookups{0};
+    atomic<uint64_t> mHits{0};
+};
+
+#endif // PACKETDEDUP_H
@@ -6,6 +6,7 @@
 #include <vector>
 #include <memory>
 #include <cstring>
+#include <stdexcept>
 
 using namespace std;
 
@@ -58,6 +59,8 @@ public:
 
     template<typename T>
     void read(T& val){
+        if (nextSize() != (int)sizeof(T))
+            throw runtime_error("parcel: size mismatch");
         readPtr(&val);
     }
 
@@ -84,6 +87,8 @@ public:
     void readString(string& val)
     {
         auto size = nextSize();
+        if (size < 0)
+            throw runtime_error("parcel: bad string size");
         unique_ptr<char[]> buf(new char[size+1]);
         readPtr(buf.get());
         buf[size]=0;
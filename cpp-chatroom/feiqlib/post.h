@@ -37,6 +37,14 @@ public:
         from = make_shared<Fellow>();
     }
 
+    /**
+     * @brief isUtf8 对方是否以UTF-8编码发送本包
+     */
+    bool isUtf8() const
+    {
+        return IS_OPT_SET(cmdId, IPMSG_UTF8OPT);
+    }
+
     void addContent(shared_ptr<Content> content)
     {
         content->setPacketNo(packetNo);
@@ -3,6 +3,8 @@
 
 #include <ostream>
 #include <memory>
+#include <string>
+#include "encoding.h"
 
 using namespace std;
 
@@ -13,6 +15,37 @@ class SendProtocol
 public:
     virtual int cmdId() = 0;
     virtual void write(ostream& os) = 0;
+
+public:
+    /**
+     * @brief setUtf8 对方支持UTF-8时直接发送，免去GBK转码；打包时会带上IPMSG_UTF8OPT
+     */
+    void setUtf8(bool utf8){mUtf8 = utf8;}
+    bool isUtf8() const{return mUtf8;}
+
+    /**
+     * @brief setFragmentable 对方能重组分片（KyLink）时，超长包拆成多个分片发送；
+     * 否则由具体协议自行保证不超过对方的接收缓冲
+     */
+    void setFragmentable(bool fragmentable){mFragmentable = fragmentable;}
+    bool isFragmentable() const{return mFragmentable;}
+
+    /**
+     * @brief setKyLink 对方是KyLink客户端时，可以带上KyLink的扩展字段（如文件的KYHASH、KYINLINE属性）
+     */
+    void setKyLink(bool kyLink){mKyLink = kyLink;}
+    bool isKyLink() const{return mKyLink;}
+
+protected:
+    string encode(const string& text) const
+    {
+        return mUtf8 ? text : encOut->convert(text);
+    }
+
+private:
+    bool mUtf8=false;
+    bool mFragmentable=false;
+    bool mKyLink=false;
 };
 
 class RecvProtocol
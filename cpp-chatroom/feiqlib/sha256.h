@@ -0,0 +1,44 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+/**
+ * @brief The Sha256 class SHA-256摘要（FIPS 180-4），用于按内容识别文件
+ */
+class Sha256
+{
+public:
+    Sha256();
+
+public:
+    void update(const void* data, size_t size);
+    /**
+     * @brief hexDigest 结束计算，返回64位小写十六进制摘要；之后不可再update
+     */
+    string hexDigest();
+
+    /**
+     * @brief ofFile 计算整个文件的摘要
+     * @return 读取失败返回空串
+     */
+    static string ofFile(const string& path);
+    /**
+     * @brief isValidHex 是否为合法的十六进制摘要
+     */
+    static bool isValidHex(const string& digest);
+
+private:
+    void transform(const uint8_t* block);
+
+private:
+    uint32_t mState[8];
+    uint8_t mBlock[64];
+    size_t mBlockLen=0;
+    uint64_t mTotalLen=0;
+};
+
+#endif // SHA256_H
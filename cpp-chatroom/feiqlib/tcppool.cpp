@@ -0,0 +1,54 @@
+#include "tcppool.h"
+
+TcpPool::TcpPool(size_t maxIdlePerIp, int msIdleTimeo)
+    :mMaxIdlePerIp(maxIdlePerIp), mIdleTimeo(msIdleTimeo)
+{
+}
+
+unique_ptr<TcpSocket> TcpPool::acquire(const string &ip, int port, int msConnectTimeo)
+{
+    {
+        lock_guard<mutex> guard(mLock);
+        auto found = mIdle.find(ip);
+        if (found != mIdle.end())
+        {
+            auto& idles = found->second;
+            auto now = steady_clock::now();
+            while (!idles.empty())
+            {
+                //后归还的更新鲜
+                auto idle = std::move(idles.back());
+                idles.pop_back();
+                if (now - idle.since < mIdleTimeo && idle.socket->isAlive())
+                    return std::move(idle.socket);
+            }
+            mIdle.erase(found);
+        }
+    }
+
+    unique_ptr<TcpSocket> socket(new TcpSocket());
+    if (!socket->connect(ip, port, msConnectTimeo))
+        return nullptr;
+
+    socket->setKeepAlive(true);
+    return socket;
+}
+
+void TcpPool::release(unique_ptr<TcpSocket> socket)
+{
+    if (socket == nullptr || !socket->isConnected())
+        return;
+
+    auto ip = socket->peerIp();
+    lock_guard<mutex> guard(mLock);
+    auto& idles = mIdle[ip];
+    idles.push_back({std::move(socket), steady_clock::now()});
+    while (idles.size() > mMaxIdlePerIp)
+        idles.pop_front();
+}
+
+void TcpPool::clear()
+{
+    lock_guard<mutex> guard(mLock);
+    mIdle.clear();
+}
@@ -0,0 +1,53 @@
+#ifndef TCPPOOL_H
+#define TCPPOOL_H
+
+#include <string>
+#include <memory>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <chrono>
+#include "tcpsocket.h"
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief The TcpPool class 按好友ip缓存空闲的tcp连接，下次请求时复用，省去握手。
+ * 空闲太久或已被对方关闭的连接在取用时丢弃。
+ */
+class TcpPool
+{
+public:
+    /**
+     * @param maxIdlePerIp 每个ip最多保留的空闲连接数
+     * @param msIdleTimeo 空闲连接的有效期（毫秒），应小于对方服务端的空闲等待
+     */
+    TcpPool(size_t maxIdlePerIp = 2, int msIdleTimeo = 15000);
+
+public:
+    /**
+     * @brief acquire 取一条到ip:port的连接，没有可用的空闲连接则新建
+     * @param msConnectTimeo 新建连接的超时（毫秒）
+     * @return 失败返回nullptr
+     */
+    unique_ptr<TcpSocket> acquire(const string& ip, int port, int msConnectTimeo);
+    /**
+     * @brief release 归还一条处于请求边界（没有未读完的数据）的连接
+     */
+    void release(unique_ptr<TcpSocket> socket);
+    void clear();
+
+private:
+    struct Idle
+    {
+        unique_ptr<TcpSocket> socket;
+        steady_clock::time_point since;
+    };
+
+    unordered_map<string, list<Idle>> mIdle;
+    mutex mLock;
+    size_t mMaxIdlePerIp;
+    milliseconds mIdleTimeo;
+};
+
+#endif // TCPPOOL_H
@@ -2,8 +2,11 @@
 #include <sys/socket.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <thread>
+#include <chrono>
 #include <unistd.h>
 
 using namespace std;
@@ -13,7 +16,7 @@ TcpServer::TcpServer()
 
 }
 
-bool TcpServer::start(int port)
+bool TcpServer::start(int port, int backlog)
 {
     if (mStarted)
         return true;
@@ -36,17 +39,26 @@ bool TcpServer::start(int port)
     if (ret == -1)
     {
         perror("bind failed");
+        close(mSocket);
+        mSocket = -1;
         return false;
     }
 
-    ret = listen(mSocket, 5);
+    //批量收文件时对方会同时发起多条连接，backlog太小会被内核丢弃
+    ret = listen(mSocket, backlog);
     if (ret == -1)
     {
         perror("listen failed");
+        close(mSocket);
+        mSocket = -1;
         return false;
     }
 
     mStarted=true;
+    {
+        lock_guard<mutex> guard(mLock);
+        mAccepting = true;
+    }
     thread thd(&TcpServer::keepAccept, this);
     thd.detach();
 
@@ -58,27 +70,119 @@ void TcpServer::whenNewClient(TcpServer::ClientHandler onClientConnected)
     mClientHandler = onClientConnected;
 }
 
+void TcpServer::setLimits(int maxClients, int maxPerIp)
+{
+    lock_guard<mutex> guard(mLock);
+    mMaxClients = maxClients;
+    mMaxPerIp = maxPerIp;
+}
+
 void TcpServer::stop()
 {
+    if (!mStarted)
+        return;
+
     mStarted = false;
+    //仅close不能唤醒阻塞中的accept
+    shutdown(mSocket, SHUT_RDWR);
+
+    //工作线程引用着this，断开各连接让处理函数尽快返回，等它们全部退出
+    unique_lock<mutex> lock(mLock);
+    for (auto handle : mClientHandles)
+        shutdown(handle, SHUT_RDWR);
+    mIdle.wait(lock, [this]{ return !mAccepting && mClients == 0; });
+    lock.unlock();
+
     close(mSocket);
+    mSocket = -1;
 }
 
 void TcpServer::keepAccept()
 {
+    auto listenSocket = mSocket;
     while (mStarted) {
         sockaddr_in addr;
         socklen_t len = sizeof(addr);
-        int ret = ::accept(mSocket, (sockaddr*)&addr, &len);
+#if defined(__linux__)
+        int ret = ::accept4(listenSocket, (sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int ret = ::accept(listenSocket, (sockaddr*)&addr, &len);
+        if (ret >= 0)
+            fcntl(ret, F_SETFL, fcntl(ret, F_GETFL, 0) | O_NONBLOCK);
+#endif
         if (ret < 0)
         {
+            if (!mStarted)
+                break;
+
+            //对方在accept前放弃、或者被信号打断，都不影响继续接受
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+                continue;
+
+            //文件描述符耗尽时稍等，等已有连接释放
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                perror("accept");
+                this_thread::sleep_for(chrono::milliseconds(100));
+                continue;
+            }
+
             perror("failed to accept");
             break;
         }
 
-        if (mClientHandler)
+        auto ip = addr.sin_addr.s_addr;
+        int handle = mClientHandler ? fcntl(ret, F_DUPFD_CLOEXEC, 0) : -1;
+        if (handle < 0 || !tryAcquire(ip, handle))
         {
-            mClientHandler(ret);
+            if (handle >= 0)
+                close(handle);
+            close(ret);
+            continue;
         }
+
+        thread thd([this, ret, ip, handle](){
+            mClientHandler(ret);
+            release(ip, handle);
+        });
+        thd.detach();
     }
+
+    lock_guard<mutex> guard(mLock);
+    mAccepting = false;
+    mIdle.notify_all();
+}
+
+bool TcpServer::tryAcquire(uint32_t ip, int handle)
+{
+    lock_guard<mutex> guard(mLock);
+    //stop已在等待时不再接新连接，否则它可能漏掉这个连接的shutdown
+    if (!mStarted)
+        return false;
+
+    auto& perIp = mClientsPerIp[ip];
+    if (mClients >= mMaxClients || perIp >= mMaxPerIp)
+    {
+        if (perIp == 0)
+            mClientsPerIp.erase(ip);
+        return false;
+    }
+
+    ++mClients;
+    ++perIp;
+    mClientHandles.insert(handle);
+    return true;
+}
+
+void TcpServer::release(uint32_t ip, int handle)
+{
+    lock_guard<mutex> guard(mLock);
+    --mClients;
+    auto found = mClientsPerIp.find(ip);
+    if (found != mClientsPerIp.end() && --found->second <= 0)
+        mClientsPerIp.erase(found);
+
+    mClientHandles.erase(handle);
+    close(handle);
+    mIdle.notify_all();
 }
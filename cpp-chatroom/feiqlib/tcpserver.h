@@ -2,22 +2,56 @@
 #define TCPSERVER_H
 
 #include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
+/**
+ * @brief The TcpServer class 监听并接受连接，每个连接交给独立的工作线程处理，
+ * accept线程只负责接受和限流，不会被慢速客户端拖住。
+ */
 class TcpServer
 {
 public:
     TcpServer();
+    /**
+     * @brief ClientHandler 在工作线程中调用，返回即关闭该连接
+     * 参数：已设为非阻塞的socket
+     */
     typedef std::function<void (int socket)> ClientHandler;
 public:
-    bool start(int port);
+    bool start(int port, int backlog = 128);
     void whenNewClient(ClientHandler onClientConnected);
+    /**
+     * @brief setLimits 设置并发连接上限，超出的连接直接关闭
+     * @param maxClients 总并发数
+     * @param maxPerIp 单个ip的并发数
+     */
+    void setLimits(int maxClients, int maxPerIp);
+    /**
+     * @brief stop 停止接受连接，断开所有在处理的连接，等accept线程和工作线程都退出后返回
+     */
     void stop();
 private:
     void keepAccept();
+    bool tryAcquire(uint32_t ip, int handle);
+    void release(uint32_t ip, int handle);
 private:
     ClientHandler mClientHandler;
-    bool mStarted=false;
-    int mSocket;
+    std::atomic<bool> mStarted{false};
+    int mSocket=-1;
+    int mMaxClients=64;
+    int mMaxPerIp=8;
+    int mClients=0;
+    bool mAccepting=false;
+    std::unordered_map<uint32_t, int> mClientsPerIp;
+    //各连接socket的dup，stop时用来shutdown；处理函数会自行关闭原socket，用dup才不会误伤复用的fd
+    std::unordered_set<int> mClientHandles;
+    std::mutex mLock;
+    std::condition_variable mIdle;
 };
 
 #endif // TCPSERVER_H
@@ -1,10 +1,19 @@
 #include "tcpsocket.h"
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
-#include <sys/time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <vector>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0//对方关闭后写入不产生SIGPIPE，没有该标志的平台依赖SO_NOSIGPIPE
+#endif
 
 TcpSocket::TcpSocket()
 {
@@ -16,6 +25,8 @@ TcpSocket::TcpSocket(int socket)
     mSocket = socket;
     if (mSocket != -1)
     {
+        setNonBlocking();
+
         sockaddr_in addr;
         socklen_t len = sizeof(addr);
         auto ret = getpeername(mSocket, (sockaddr*)&addr, &len);
@@ -31,7 +42,7 @@ TcpSocket::~TcpSocket()
     disconnect();
 }
 
-bool TcpSocket::connect(const string &ip, int port)
+bool TcpSocket::connect(const string &ip, int port, int msTimeout)
 {
     if (mSocket != -1)
         return true;
@@ -43,15 +54,31 @@ bool TcpSocket::connect(const string &ip, int port)
         return false;
     }
 
+    setNonBlocking();
+
     sockaddr_in addr;
     addr.sin_addr.s_addr = inet_addr(ip.c_str());
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
+
     int ret = ::connect(mSocket, (sockaddr*)&addr, sizeof(addr));
+    if (ret == -1 && errno == EINPROGRESS)
+    {
+        if (waitFor(POLLOUT, msTimeout))
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(mSocket, SOL_SOCKET, SO_ERROR, &err, &len);
+            errno = err;
+            ret = err == 0 ? 0 : -1;
+        }
+    }
+
     if (ret == -1)
     {
         perror("failed to connect");
         close(mSocket);
+        mSocket = -1;
         return false;
     }
 
@@ -64,50 +91,179 @@ void TcpSocket::disconnect()
     if (mSocket != -1)
     {
         close(mSocket);
+        mSocket = -1;
         mPeerIp="";
     }
 }
 
-int TcpSocket::send(const void *data, int size)
+bool TcpSocket::isAlive() const
 {
-    int sent = 0;
-    auto pdata = static_cast<const char*>(data);
+    if (mSocket == -1)
+        return false;
+
+    //空闲连接不应有数据可读，可读说明对方关闭了（或协议已错乱），都不能再用
+    pollfd pfd = {mSocket, POLLIN, 0};
+    auto ret = poll(&pfd, 1, 0);
+    return ret == 0;
+}
+
+void TcpSocket::setKeepAlive(bool enable)
+{
+    int val = enable ? 1 : 0;
+    setsockopt(mSocket, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
+}
+
+void TcpSocket::setNoDelay(bool enable)
+{
+    int val = enable ? 1 : 0;
+    setsockopt(mSocket, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+}
+
+void TcpSocket::setCork(bool enable)
+{
+#if defined(TCP_CORK)
+    int val = enable ? 1 : 0;
+    setsockopt(mSocket, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+#else
+    (void)enable;
+#endif
+}
+
+void TcpSocket::setBufferSizes(int sendSize, int recvSize)
+{
+    if (sendSize > 0)
+        setsockopt(mSocket, SOL_SOCKET, SO_SNDBUF, &sendSize, sizeof(sendSize));
+    if (recvSize > 0)
+        setsockopt(mSocket, SOL_SOCKET, SO_RCVBUF, &recvSize, sizeof(recvSize));
+}
+
+int TcpSocket::send(const void *data, int size, int msTimeout)
+{
+    iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = size;
+    return sendv(&iov, 1, msTimeout);
+}
+
+int TcpSocket::sendv(const iovec *iov, int count, int msTimeout)
+{
+    if (mSocket == -1)
+        return -1;
+
+    //发送一部分后要跳过已发的，复制一份以便修改
+    std::vector<iovec> left(iov, iov+count);
+    size_t first = 0;
+    int total = 0;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
 
-    while (sent < size)
+    while (first < left.size())
     {
-        int ret = ::send(mSocket, pdata+sent, size-sent, 0);
-        if (ret == -1 )
+        msg.msg_iov = &left[first];
+        msg.msg_iovlen = left.size() - first;
+
+        auto ret = ::sendmsg(mSocket, &msg, MSG_NOSIGNAL);
+        if (ret == -1)
         {
-            if (errno != EAGAIN)
-            {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFor(POLLOUT, msTimeout))
+                continue;
+
+            if (errno != ETIMEDOUT)
                 perror("tcp send failed");
-                return -1;
-            }
-            continue;
+            return -1;
         }
 
-        sent+=ret;
+        total += ret;
+        while (first < left.size() && static_cast<size_t>(ret) >= left[first].iov_len)
+        {
+            ret -= left[first].iov_len;
+            ++first;
+        }
+        if (first < left.size())
+        {
+            left[first].iov_base = static_cast<char*>(left[first].iov_base) + ret;
+            left[first].iov_len -= ret;
+        }
     }
 
-    return sent;
+    return total;
 }
 
 int TcpSocket::recv(void *data, int size, int msTimeout)
 {
-    timeval tv = {msTimeout/1000, (msTimeout%1000)*1000};
-    setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+    return recvv(&iov, 1, msTimeout);
+}
 
-    int ret = ::recv(mSocket, data, size, 0);
-    if (ret == -1)
+int TcpSocket::recvv(const iovec *iov, int count, int msTimeout)
+{
+    if (mSocket == -1)
+        return -2;
+
+    //先直接读，没有数据再等，数据连续到达时省去poll
+    while (true)
     {
-        if (errno == ETIMEDOUT || errno == EAGAIN)
-            return -1;
-        else
+        auto ret = ::readv(mSocket, iov, count);
+        if (ret >= 0)
+            return ret;
+
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
         {
             perror("recv failed");
             return -2;
         }
+        if (!waitFor(POLLIN, msTimeout))
+            return errno == ETIMEDOUT ? -1 : -2;
     }
+}
 
-    return ret;
+int TcpSocket::recvAll(void *data, int size, int msTimeout)
+{
+    auto pdata = static_cast<char*>(data);
+    int got = 0;
+    while (got < size)
+    {
+        auto ret = recv(pdata+got, size-got, msTimeout);
+        if (ret <= 0)
+            return ret;
+        got += ret;
+    }
+    return got;
+}
+
+bool TcpSocket::waitFor(short events, int msTimeout)
+{
+    pollfd pfd = {mSocket, events, 0};
+    while (true)
+    {
+        auto ret = poll(&pfd, 1, msTimeout);
+        if (ret > 0)
+            return true;//出错或对方关闭也算就绪，交给随后的读写报告
+
+        if (ret == 0)
+        {
+            errno = ETIMEDOUT;
+            return false;
+        }
+
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+void TcpSocket::setNonBlocking()
+{
+    auto flags = fcntl(mSocket, F_GETFL, 0);
+    fcntl(mSocket, F_SETFL, flags | O_NONBLOCK);
+#if defined(SO_NOSIGPIPE)
+    int val = 1;
+    setsockopt(mSocket, SOL_SOCKET, SO_NOSIGPIPE, &val, sizeof(val));
+#endif
 }
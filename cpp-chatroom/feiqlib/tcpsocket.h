@@ -2,8 +2,13 @@
 #define TCPSOCKET_H
 
 #include <string>
+#include <sys/uio.h>
 using namespace std;
 
+/**
+ * @brief The TcpSocket class 非阻塞tcp连接，收发的等待都由poll按超时控制，
+ * 不会无限阻塞，也不用每次调用都设置socket选项
+ */
 class TcpSocket
 {
 public:
@@ -12,19 +17,68 @@ public:
     ~TcpSocket();
 
 public:
-    bool connect(const string& ip, int port);
+    /**
+     * @brief connect 连接到对方
+     * @param msTimeout 连接超时（毫秒），<0则一直等待
+     * @return 是否连接成功
+     */
+    bool connect(const string& ip, int port, int msTimeout = 3000);
     void disconnect();
+    bool isConnected() const{return mSocket != -1;}
+    /**
+     * @brief isAlive 连接空闲时检查对方是否已经关闭，不阻塞
+     */
+    bool isAlive() const;
+    string peerIp() const{return mPeerIp;}
+
+public:
+    void setKeepAlive(bool enable);
+    /**
+     * @brief setNoDelay 关闭Nagle，小包（如文件请求）立即发出
+     */
+    void setNoDelay(bool enable);
+    /**
+     * @brief setCork 开启后内核攒满整段再发，关闭时把攒下的立即发出（仅Linux有效）
+     */
+    void setCork(bool enable);
+    /**
+     * @brief setBufferSizes 设置内核收发缓冲区大小（字节），<=0表示不改
+     */
+    void setBufferSizes(int sendSize, int recvSize);
 
 public:
-    int send(const void* data, int size);
     /**
-     * @brief recv 阻塞等待数据
+     * @brief send 发送全部数据
+     * @param msTimeout 每次等待可写的超时（毫秒）
+     * @return 发送的字节数；超时或出错返回-1
+     */
+    int send(const void* data, int size, int msTimeout = 5000);
+    /**
+     * @brief sendv 聚合发送多段数据（writev），全部发完才返回
+     * @return 同send
+     */
+    int sendv(const iovec* iov, int count, int msTimeout = 5000);
+    /**
+     * @brief recv 等待并接收数据
      * @param data 接收缓冲区
      * @param size 最大接收字节数
      * @param msTimeout 接收超时（毫秒）
-     * @return 接收到的字节数；超时返回-1，其他错误返回-2
+     * @return 接收到的字节数，0表示对方已关闭；超时返回-1，其他错误返回-2
      */
     int recv(void* data, int size, int msTimeout = 1000);
+    /**
+     * @brief recvv 分散接收到多段缓冲区（readv），返回值同recv
+     */
+    int recvv(const iovec* iov, int count, int msTimeout = 1000);
+    /**
+     * @brief recvAll 收满size字节，每次等待的超时为msTimeout
+     * @return size；对方关闭返回0，超时返回-1，其他错误返回-2
+     */
+    int recvAll(void* data, int size, int msTimeout = 1000);
+
+private:
+    bool waitFor(short events, int msTimeout);
+    void setNonBlocking();
 
 private:
     int mSocket=-1;
@@ -0,0 +1,61 @@
+#include "timerwheel.h"
+
+TimerWheel::TimerWheel(int tickMs, int slots)
+    :mSlots(slots > 0 ? slots : 1), mTickMs(tickMs > 0 ? tickMs : 1)
+{
+}
+
+void TimerWheel::schedule(const string &key, int64_t when)
+{
+    auto tick = when / mTickMs;
+    //已经走过的格不会再检查，过期的定时放到下一格
+    if (mCurrentTick >= 0 && tick <= mCurrentTick)
+        tick = mCurrentTick + 1;
+
+    mSlots[tick % mSlots.size()].push_back({key, when});
+    ++mCount;
+}
+
+vector<string> TimerWheel::advance(int64_t now)
+{
+    vector<string> expired;
+    auto nowTick = now / mTickMs;
+    if (mCurrentTick < 0)
+        mCurrentTick = nowTick - 1;
+    if (nowTick <= mCurrentTick)
+        return expired;
+
+    //间隔超过一圈时，每个槽位检查一次即可
+    int64_t steps = nowTick - mCurrentTick;
+    if (steps > static_cast<int64_t>(mSlots.size()))
+        steps = mSlots.size();
+
+    for (int64_t i = 0; i < steps; i++)
+    {
+        auto& slot = mSlots[(nowTick - i) % mSlots.size()];
+        for (auto it = slot.begin(); it != slot.end();)
+        {
+            if (it->when <= now)
+            {
+                expired.push_back(std::move(it->key));
+                it = slot.erase(it);
+                --mCount;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    mCurrentTick = nowTick;
+    return expired;
+}
+
+void TimerWheel::clear()
+{
+    for (auto& slot : mSlots)
+        slot.clear();
+    mCount = 0;
+    mCurrentTick = -1;
+}
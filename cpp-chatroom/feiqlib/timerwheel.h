@@ -0,0 +1,52 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <cstdint>
+using namespace std;
+
+/**
+ * @brief The TimerWheel class 单层时间轮
+ * 定时按到期时间散列到槽位，推进时只检查走过的槽位，插入和推进都与定时总数无关。
+ * 超过一圈的定时留在槽中，等转到它那一圈再到期。非线程安全，由调用方加锁。
+ */
+class TimerWheel
+{
+public:
+    /**
+     * @param tickMs 每格的时长（毫秒），即到期精度
+     * @param slots 槽位数，tickMs*slots为一圈的时长
+     */
+    TimerWheel(int tickMs = 1000, int slots = 256);
+
+public:
+    /**
+     * @brief schedule 添加一个定时，同一key可重复添加，各自独立到期
+     * @param key 定时的标识
+     * @param when 到期时间（毫秒）
+     */
+    void schedule(const string& key, int64_t when);
+    /**
+     * @brief advance 推进到now，取出所有已到期的定时
+     * @return 到期定时的key
+     */
+    vector<string> advance(int64_t now);
+    size_t size() const{return mCount;}
+    void clear();
+
+private:
+    struct Timer
+    {
+        string key;
+        int64_t when;
+    };
+
+    vector<list<Timer>> mSlots;
+    int mTickMs;
+    int64_t mCurrentTick=-1;//已推进到的格，-1表示尚未推进过
+    size_t mCount=0;
+};
+
+#endif // TIMERWHEEL_H
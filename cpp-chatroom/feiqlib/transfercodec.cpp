@@ -0,0 +1,137 @@
+#include "transfercodec.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <array>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+//采样的熵（比特/字节）超过此值视为已压缩或随机数据
+static const double kMaxEntropy = 7.5;
+//压缩后不小于原始的此比例，则原样存放
+static const double kMinGain = 0.9;
+//连续压不动的块数达到此值，不再尝试
+static const int kMaxMisses = 4;
+//熵采样长度
+static const size_t kEntropySample = 4096;
+
+bool TransferCodec::canCompress()
+{
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool TransferCodec::isPrecompressed(const string &fileName)
+{
+    static const char* exts[] = {
+        "jpg", "jpeg", "png", "gif", "webp", "heic",
+        "mp3", "aac", "ogg", "flac", "mp4", "mkv", "avi", "mov", "webm",
+        "zip", "gz", "tgz", "bz2", "xz", "7z", "rar", "zst", "lz4",
+        "apk", "jar", "docx", "xlsx", "pptx", "pdf"
+    };
+
+    auto dot = fileName.rfind('.');
+    if (dot == string::npos)
+        return false;
+
+    auto ext = fileName.substr(dot+1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    for (auto e : exts)
+    {
+        if (ext == e)
+            return true;
+    }
+    return false;
+}
+
+static double entropyOf(const char* data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    std::array<size_t, 256> counts{};
+    for (size_t i = 0; i < size; i++)
+        counts[static_cast<unsigned char>(data[i])]++;
+
+    double entropy = 0;
+    for (auto count : counts)
+    {
+        if (count == 0)
+            continue;
+        double p = static_cast<double>(count) / size;
+        entropy -= p * log2(p);
+    }
+    return entropy;
+}
+
+TransferCodec::TransferCodec(bool tryCompress)
+    :mTryCompress(tryCompress && canCompress())
+{
+}
+
+static void putHeader(vector<char>& out, uint32_t rawSize, uint32_t packedSize)
+{
+    uint32_t header[2] = {htonl(rawSize), htonl(packedSize)};
+    auto ptr = reinterpret_cast<const char*>(header);
+    out.insert(out.end(), ptr, ptr+sizeof(header));
+}
+
+void TransferCodec::encode(const char *data, size_t size, vector<char> &out)
+{
+#ifdef HAVE_ZLIB
+    if (mTryCompress && entropyOf(data, std::min(size, kEntropySample)) < kMaxEntropy)
+    {
+        uLongf packedSize = compressBound(size);
+        mBuf.resize(packedSize);
+        auto ret = compress2(reinterpret_cast<Bytef*>(mBuf.data()), &packedSize,
+                             reinterpret_cast<const Bytef*>(data), size, 1);
+        if (ret == Z_OK && packedSize < size * kMinGain)
+        {
+            mMisses = 0;
+            putHeader(out, size, packedSize);
+            out.insert(out.end(), mBuf.begin(), mBuf.begin()+packedSize);
+            return;
+        }
+    }
+
+    if (mTryCompress && ++mMisses >= kMaxMisses)
+        mTryCompress = false;
+#endif
+
+    putHeader(out, size, size);
+    out.insert(out.end(), data, data+size);
+}
+
+bool TransferCodec::parseHeader(const char *header, uint32_t &rawSize, uint32_t &packedSize)
+{
+    uint32_t values[2];
+    memcpy(values, header, sizeof(values));
+    rawSize = ntohl(values[0]);
+    packedSize = ntohl(values[1]);
+
+    //压缩后不会超过原始长度（否则原样存放），块也不会超过kChunkSize
+    return rawSize > 0 && rawSize <= kChunkSize && packedSize > 0 && packedSize <= rawSize;
+}
+
+bool TransferCodec::decode(const char *packed, size_t packedSize, char *raw, size_t rawSize)
+{
+    if (packedSize == rawSize)
+    {
+        memcpy(raw, packed, rawSize);
+        return true;
+    }
+
+#ifdef HAVE_ZLIB
+    uLongf size = rawSize;
+    auto ret = uncompress(reinterpret_cast<Bytef*>(raw), &size,
+                          reinterpret_cast<const Bytef*>(packed), packedSize);
+    return ret == Z_OK && size == rawSize;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,56 @@
+#ifndef TRANSFERCODEC_H
+#define TRANSFERCODEC_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+/**
+ * @brief The TransferCodec class KyLink文件传输的分块压缩
+ * 每块格式：[原始长度u32][传输长度u32][数据]，网络字节序；传输长度等于原始长度表示该块原样存放。
+ * 各块独立压缩（zlib level 1），不依赖前面的块。
+ * 已压缩格式（按扩展名）或高熵数据原样发送，连续几块压不动后整个文件不再尝试。
+ */
+class TransferCodec
+{
+public:
+    static const size_t kChunkSize = 64*1024;
+    static const size_t kHeaderSize = 8;
+
+    /**
+     * @brief canCompress 编译时是否带有压缩库；没有时仍可收发原样存放的块
+     */
+    static bool canCompress();
+    /**
+     * @brief isPrecompressed 按扩展名判断文件是否本身已经压缩过（图片、视频、压缩包等）
+     */
+    static bool isPrecompressed(const string& fileName);
+
+public:
+    explicit TransferCodec(bool tryCompress);
+
+    /**
+     * @brief encode 编码一块（不超过kChunkSize），块头和数据追加到out
+     */
+    void encode(const char* data, size_t size, vector<char>& out);
+
+    /**
+     * @brief parseHeader 解析块头
+     * @return 块头是否合法
+     */
+    static bool parseHeader(const char* header, uint32_t& rawSize, uint32_t& packedSize);
+    /**
+     * @brief decode 解码一块的数据到raw，raw须有rawSize大小
+     * @return 是否解码成功且长度一致
+     */
+    static bool decode(const char* packed, size_t packedSize, char* raw, size_t rawSize);
+
+private:
+    bool mTryCompress;
+    int mMisses=0;//连续压不动的块数
+    vector<char> mBuf;
+};
+
+#endif // TRANSFERCODEC_H
@@ -20,6 +20,8 @@
 #include <iomanip>
 #endif
 #include <array>
+#include <algorithm>
+#include <time.h>
 
 #define setFailedMsgAndReturnFalse(msg) \
     {mErrMsg = msg;\
@@ -66,23 +68,150 @@ bool UdpCommu::bindTo(int port)
     if (ret == -1)
         setErrnoMsgAndReturnFalse();
 
+#if defined(__linux__)
+    //收包时带上到达的网卡
+    auto pktinfo = 1;
+    ret = setsockopt(mSocket, IPPROTO_IP, IP_PKTINFO, &pktinfo, sizeof(int));
+    if (ret == -1)
+        setErrnoMsgAndReturnFalse();
+#endif
+
+    mPort = port;
+    refreshInterfaces();
     return true;
 }
 
 int UdpCommu::sentTo(const string& ip, int port, const void *data, int size)
+{
+    auto dst = inet_addr(ip.c_str());
+    if (dst == htonl(INADDR_BROADCAST))
+        return broadcastAll(port, data, size);
+    if (IN_MULTICAST(ntohl(dst)))
+        return multicastAll(dst, port, data, size);
+
+    //对方从哪块网卡来，就从哪块网卡回
+    int ifIndex = 0;
+    uint32_t srcAddr = 0;
+    {
+        lock_guard<mutex> guard(mIfLock);
+        auto found = mPeerIf.find(dst);
+        if (found != mPeerIf.end())
+        {
+            for (auto& iface : mInterfaces)
+            {
+                if (iface.index == found->second)
+                {
+                    ifIndex = iface.index;
+                    srcAddr = iface.addr;
+                    break;
+                }
+            }
+        }
+    }
+
+    auto ret = sendVia(dst, port, data, size, ifIndex, srcAddr);
+    if (ret == -1 && ifIndex != 0)
+    {
+        //网卡可能已经不在了，交给路由表重新选
+        lock_guard<mutex> guard(mIfLock);
+        mPeerIf.erase(dst);
+    }
+
+    return ret;
+}
+
+int UdpCommu::sendVia(uint32_t dst, int port, const void *data, int size, int ifIndex, uint32_t srcAddr)
 {
     sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(ip.c_str());
+    addr.sin_addr.s_addr = dst;
     addr.sin_port = htons(port);
 
-    auto ret = ::sendto(mSocket, data, size, 0, (sockaddr*)&addr, sizeof(addr));
+    ssize_t ret = -1;
+#if defined(__linux__)
+    if (ifIndex > 0)
+    {
+        iovec iov;
+        iov.iov_base = const_cast<void*>(data);
+        iov.iov_len = size;
+
+        char control[CMSG_SPACE(sizeof(in_pktinfo))];
+        memset(control, 0, sizeof(control));
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(in_pktinfo));
+        auto info = reinterpret_cast<in_pktinfo*>(CMSG_DATA(cmsg));
+        info->ipi_ifindex = ifIndex;
+        info->ipi_spec_dst.s_addr = srcAddr;
+
+        ret = ::sendmsg(mSocket, &msg, 0);
+    }
+    else
+#else
+    (void)ifIndex;
+    (void)srcAddr;
+#endif
+    {
+        ret = ::sendto(mSocket, data, size, 0, (sockaddr*)&addr, sizeof(addr));
+    }
+
     if (ret == -1)
         setErrnoMsg();
 
     return ret;
 }
 
+//网卡列表的有效期（秒），过期后下次广播前重新枚举
+static const int kInterfacesTtl = 30;
+
+int UdpCommu::broadcastAll(int port, const void *data, int size)
+{
+    vector<NetInterface> ifaces;
+    {
+        lock_guard<mutex> guard(mIfLock);
+        if (time(nullptr) - mInterfacesTime < kInterfacesTtl)
+            ifaces = mInterfaces;
+    }
+    if (ifaces.empty())
+    {
+        refreshInterfaces();
+        ifaces = interfaces();
+    }
+
+    //每个子网只发一次（同一网卡可能有多个同网段地址）
+    vector<uint32_t> sent;
+    int ret = -1;
+    for (auto& iface : ifaces)
+    {
+        if (iface.broadcast == 0
+                || std::find(sent.begin(), sent.end(), iface.broadcast) != sent.end())
+            continue;
+
+        sent.push_back(iface.broadcast);
+        auto r = sendVia(iface.broadcast, port, data, size, iface.index, iface.addr);
+        if (r >= 0)
+            ret = r;
+    }
+
+    //枚举不到网卡时退回到受限广播
+    if (sent.empty())
+        ret = sendVia(htonl(INADDR_BROADCAST), port, data, size, 0, 0);
+
+    return ret;
+}
+
 bool UdpCommu::startAsyncRecv(UdpRecvHandler handler)
 {
     if (handler == nullptr)
@@ -112,6 +241,72 @@ void UdpCommu::close()
     mAsyncMode=false;
 }
 
+int UdpCommu::multicastAll(uint32_t group, int port, const void *data, int size)
+{
+    auto ifaces = interfaces();
+
+    //默认只会从路由表选中的一块网卡发出，这里每块网卡各发一次
+    vector<int> sent;
+    int ret = -1;
+    for (auto& iface : ifaces)
+    {
+        if (iface.index <= 0 || std::find(sent.begin(), sent.end(), iface.index) != sent.end())
+            continue;
+
+        sent.push_back(iface.index);
+        auto r = sendVia(group, port, data, size, iface.index, iface.addr);
+        if (r >= 0)
+            ret = r;
+    }
+
+    if (sent.empty())
+        ret = sendVia(group, port, data, size, 0, 0);
+
+    return ret;
+}
+
+bool UdpCommu::joinMulticast(const string &group, int ttl)
+{
+    if (mSocket == -1)
+        setFailedMsgAndReturnFalse("请先初始化socket");
+
+    in_addr groupAddr;
+    if (inet_aton(group.c_str(), &groupAddr) == 0 || !IN_MULTICAST(ntohl(groupAddr.s_addr)))
+        setFailedMsgAndReturnFalse("无效的组播地址:"+group);
+
+    //跨路由需要ttl>1；自己发的组播不必回环给自己
+    unsigned char mttl = static_cast<unsigned char>(ttl < 1 ? 1 : (ttl > 255 ? 255 : ttl));
+    if (setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl)) == -1)
+        setErrnoMsgAndReturnFalse();
+
+    unsigned char loop = 0;
+    if (setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == -1)
+        setErrnoMsgAndReturnFalse();
+
+    auto ifaces = interfaces();
+    if (ifaces.empty())
+    {
+        NetInterface any;
+        any.addr = htonl(INADDR_ANY);
+        ifaces.push_back(any);
+    }
+
+    bool joined = false;
+    for (auto& iface : ifaces)
+    {
+        ip_mreq mreq;
+        mreq.imr_multiaddr = groupAddr;
+        mreq.imr_interface.s_addr = iface.addr;
+        if (setsockopt(mSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0
+                || errno == EADDRINUSE)//已加入过
+            joined = true;
+        else
+            setErrnoMsg();
+    }
+
+    return joined;
+}
+
 string UdpCommu::getBoundMac()
 {
 #if defined(__APPLE__)
@@ -153,36 +348,107 @@ string UdpCommu::getBoundMac()
 
     return macStr;
 #elif defined(__linux__)
+    //优先取有IPv4地址的网卡，跳过lo这类全0的mac
+    auto ifaces = interfaces();
+    if (ifaces.empty())
+    {
+        refreshInterfaces();
+        ifaces = interfaces();
+    }
+
+    for (auto& iface : ifaces)
+    {
+        if (!iface.mac.empty() && iface.mac.find_first_not_of('0') != string::npos)
+            return iface.mac;
+    }
+
+    return "";
+#else
+    return "";
+#endif
+}
+
+void UdpCommu::refreshInterfaces()
+{
+    vector<NetInterface> ifaces;
+#if defined(__linux__)
     struct ifaddrs *ifaddr = nullptr;
     if (getifaddrs(&ifaddr) != 0)
-        return "";
+        return;
 
-    string result;
+    unordered_map<string, string> macs;
     for (struct ifaddrs *ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == nullptr)
+        if (ifa->ifa_addr == nullptr || ifa->ifa_addr->sa_family != AF_PACKET)
             continue;
 
-        if (ifa->ifa_addr->sa_family == AF_PACKET) {
-            auto *s = reinterpret_cast<struct sockaddr_ll *>(ifa->ifa_addr);
-            if (s->sll_halen != 6)
-                continue;
+        auto *s = reinterpret_cast<struct sockaddr_ll *>(ifa->ifa_addr);
+        if (s->sll_halen != 6)
+            continue;
 
-            std::ostringstream oss;
-            oss << std::hex << std::setfill('0');
-            for (int i = 0; i < 6; ++i) {
-                oss << std::setw(2) << static_cast<int>(static_cast<unsigned char>(s->sll_addr[i]));
-            }
-            result = oss.str();
-            if (!result.empty())
-                break;
+        std::ostringstream oss;
+        oss << std::hex << std::setfill('0');
+        for (int i = 0; i < 6; ++i) {
+            oss << std::setw(2) << static_cast<int>(static_cast<unsigned char>(s->sll_addr[i]));
         }
+        macs[ifa->ifa_name] = oss.str();
+    }
+
+    for (struct ifaddrs *ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == nullptr || ifa->ifa_addr->sa_family != AF_INET)
+            continue;
+        if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK))
+            continue;
+
+        NetInterface iface;
+        iface.name = ifa->ifa_name;
+        iface.index = if_nametoindex(ifa->ifa_name);
+        iface.addr = reinterpret_cast<sockaddr_in*>(ifa->ifa_addr)->sin_addr.s_addr;
+        if (ifa->ifa_netmask != nullptr)
+            iface.mask = reinterpret_cast<sockaddr_in*>(ifa->ifa_netmask)->sin_addr.s_addr;
+        if ((ifa->ifa_flags & IFF_BROADCAST) && ifa->ifa_broadaddr != nullptr)
+            iface.broadcast = reinterpret_cast<sockaddr_in*>(ifa->ifa_broadaddr)->sin_addr.s_addr;
+        iface.mac = macs[iface.name];
+        ifaces.push_back(iface);
     }
 
     freeifaddrs(ifaddr);
-    return result;
-#else
-    return "";
 #endif
+
+    lock_guard<mutex> guard(mIfLock);
+    mInterfaces = ifaces;
+    mInterfacesTime = time(nullptr);
+}
+
+vector<NetInterface> UdpCommu::interfaces() const
+{
+    lock_guard<mutex> guard(mIfLock);
+    return mInterfaces;
+}
+
+bool UdpCommu::isLocalBroadcast(const string &ip) const
+{
+    auto addr = inet_addr(ip.c_str());
+    lock_guard<mutex> guard(mIfLock);
+    for (auto& iface : mInterfaces)
+    {
+        if (iface.broadcast != 0 && iface.broadcast == addr)
+            return true;
+    }
+    return false;
+}
+
+bool UdpCommu::isOwnAddress(uint32_t addr) const
+{
+    if ((ntohl(addr) >> 24) == 127)
+        return true;
+
+    lock_guard<mutex> guard(mIfLock);
+    for (auto& iface : mInterfaces)
+    {
+        if (iface.addr == addr)
+            return true;
+    }
+    return false;
 }
 
 string UdpCommu::getErrMsg()
@@ -202,13 +468,40 @@ void UdpCommu::recvThread()
 
     std::array<char,MAX_RCV_SIZE> buf;
     sockaddr_in addr;
-    socklen_t len = sizeof(addr);
 
     while (mSocket != -1) {
         buf.fill(0);
-        memset(&addr, 0, len);
-
+        memset(&addr, 0, sizeof(addr));
+        int ifIndex = 0;
+
+#if defined(__linux__)
+        iovec iov;
+        iov.iov_base = buf.data();
+        iov.iov_len = MAX_RCV_SIZE;
+
+        char control[CMSG_SPACE(sizeof(in_pktinfo))];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        auto size = recvmsg(mSocket, &msg, 0);
+        if (size >= 0)
+        {
+            for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+                    ifIndex = reinterpret_cast<in_pktinfo*>(CMSG_DATA(cmsg))->ipi_ifindex;
+            }
+        }
+#else
+        socklen_t len = sizeof(addr);
         auto size = recvfrom(mSocket, buf.data(), MAX_RCV_SIZE, 0, (sockaddr*)&addr, &len);
+#endif
         if (size < 0)
         {
             if (errno == EAGAIN || errno == ETIMEDOUT)
@@ -218,6 +511,16 @@ void UdpCommu::recvThread()
             break;
         }
 
+        //本机自己发出的广播会被回送回来，不必进入解析
+        if (ntohs(addr.sin_port) == mPort && isOwnAddress(addr.sin_addr.s_addr))
+            continue;
+
+        if (ifIndex > 0)
+        {
+            lock_guard<mutex> guard(mIfLock);
+            mPeerIf[addr.sin_addr.s_addr] = ifIndex;
+        }
+
         auto ip = inet_ntoa(addr.sin_addr);
         vector<char> data(std::begin(buf), std::begin(buf)+size);
         mRecvHandler(ip, data);
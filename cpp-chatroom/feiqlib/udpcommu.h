@@ -4,11 +4,32 @@
 #include <string>
 #include <functional>
 #include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
 using namespace std;
 
 #define MAX_RCV_SIZE 4096
 typedef function<void (const string& ip, vector<char> &data)> UdpRecvHandler;
 
+/**
+ * @brief The NetInterface struct 本机的一个IPv4网卡，地址均为网络字节序
+ */
+struct NetInterface
+{
+    string name;
+    int index=0;
+    uint32_t addr=0;
+    uint32_t mask=0;
+    uint32_t broadcast=0;
+    string mac;
+};
+
+/**
+ * @brief The UdpCommu class 单个INADDR_ANY socket，借助IP_PKTINFO区分网卡：
+ * 记录每个来源从哪块网卡收到，单播回复走同一块网卡；
+ * 全局广播按网卡逐个发子网广播，每块网卡只发一次。
+ */
 class UdpCommu
 {
 public:
@@ -45,9 +66,26 @@ public:
 
     /**
      * @brief getBoundMac 获取udp通信绑定的网卡
-     * @return 绑定的网卡地址
+     * @return 绑定的网卡地址，多网卡时取第一块有有效mac的网卡
      */
     string getBoundMac();
+
+    /**
+     * @brief refreshInterfaces 重新枚举本机网卡，网卡变化（如切换wifi）后调用
+     */
+    void refreshInterfaces();
+    vector<NetInterface> interfaces() const;
+    /**
+     * @brief joinMulticast 在每块网卡上加入组播组，之后发往该组的包按网卡逐个发出
+     * @param group 组播地址（224.0.0.0/4）
+     * @param ttl 组播跳数，跨几级路由
+     * @return 至少一块网卡加入成功
+     */
+    bool joinMulticast(const string& group, int ttl);
+    /**
+     * @brief isLocalBroadcast ip是否是某块本机网卡的子网广播地址
+     */
+    bool isLocalBroadcast(const string& ip) const;
 public:
     /**
      * @brief getErrMsg 获取最近一次错误的错误信息
@@ -57,12 +95,21 @@ public:
 
 private:
     void recvThread();
+    int sendVia(uint32_t dst, int port, const void *data, int size, int ifIndex, uint32_t srcAddr);
+    int broadcastAll(int port, const void *data, int size);
+    int multicastAll(uint32_t group, int port, const void *data, int size);
+    bool isOwnAddress(uint32_t addr) const;
     bool mAsyncMode=false;
 
 private:
     string mErrMsg="";
     int mSocket=-1;
+    int mPort=0;
     UdpRecvHandler mRecvHandler=nullptr;
+    vector<NetInterface> mInterfaces;
+    int64_t mInterfacesTime=0;//上次枚举网卡的时间（秒）
+    unordered_map<uint32_t, int> mPeerIf;//来源地址 -> 收到它的网卡
+    mutable mutex mIfLock;
 };
 
 #endif // UDPCOMMU_H
@@ -6,6 +6,11 @@ UniqueId::UniqueId()
     mId = 0;
 }
 
+UniqueId::UniqueId(IdType start)
+{
+    mId = start;
+}
+
 IdType UniqueId::get()
 {
     auto id = ++mId;
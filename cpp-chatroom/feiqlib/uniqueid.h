@@ -12,6 +12,10 @@ class UniqueId
 {
 public:
     UniqueId();
+    /**
+     * @brief UniqueId 从指定值开始计数，用于包序号这类需要跨进程重启不重复的场景
+     */
+    explicit UniqueId(IdType start);
 public:
     IdType get();
 private:
@@ -73,6 +73,34 @@ bool endsWith(const string &str, const string &patten)
     return std::equal(patten.rbegin(), patten.rend(), str.rbegin());
 }
 
+string truncateEncoded(const string &str, size_t maxBytes, bool utf8)
+{
+    if (str.size() <= maxBytes)
+        return str;
+
+    size_t cut = 0;
+    if (utf8)
+    {
+        //退到一个非后续字节(10xxxxxx)处
+        cut = maxBytes;
+        while (cut > 0 && (static_cast<unsigned char>(str[cut]) & 0xC0) == 0x80)
+            --cut;
+    }
+    else
+    {
+        //GBK：高位为1的字节是双字节字符的首字节
+        while (cut < maxBytes)
+        {
+            auto step = (static_cast<unsigned char>(str[cut]) & 0x80) ? 2u : 1u;
+            if (cut + step > maxBytes)
+                break;
+            cut += step;
+        }
+    }
+
+    return str.substr(0, cut);
+}
+
 string toString(const vector<char> &buf)
 {
     auto len = buf.size();
@@ -10,4 +10,9 @@ string getFileNameFromPath(const string& path);
 bool startsWith(const string& str, const string& patten);
 bool endsWith(const string& str, const string& patten);
 string toString(const vector<char>& buf);
+/**
+ * @brief truncateEncoded 按字符边界截断已编码的字符串，使其不超过maxBytes
+ * @param utf8 true为UTF-8，否则按GBK处理
+ */
+string truncateEncoded(const string& str, size_t maxBytes, bool utf8);
 #endif // UTILS_H
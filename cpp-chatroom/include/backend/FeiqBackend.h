@@ -27,11 +27,15 @@ public:
 
     // 启用定期用户发现广播（秒）
     void enableIntervalDetect(int seconds = 10);
+    // 启用组播发现（可跨路由），group为空时不启用
+    bool enableMulticastDiscovery(const QString& group, int ttl = 8, QString* error = nullptr);
 
     QList<FeiqFellowInfo> fellows() const;
 
     bool sendText(const QString& ip, const QString& text, const QString& format = QString(), QString* error = nullptr);
     bool sendFiles(const QString& ip, const QStringList& filePaths, QString* error = nullptr);
+    // 以内嵌图片发送，KyLink好友收到后自动下载显示，其他好友收到的是普通文件
+    bool sendImage(const QString& ip, const QString& imagePath, QString* error = nullptr);
     bool acceptFile(const QString& ip, quint32 packetNo, quint32 fileId, const QString& savePath, QString* error = nullptr);
     void cancelFileTask(quint32 packetNo, quint32 fileId, bool upload);
 
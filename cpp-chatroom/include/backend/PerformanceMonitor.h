@@ -93,6 +93,8 @@ public:
                            qint64 renderCompleteTimestampNs);
 
     QVector<FrameTimings> recentFrameHistory(int maxSamples = -1) const;
+    // Time since a still-tracked frame was captured, -1 if unknown.
+    qint64 frameCaptureAgeUs(quint64 frameId) const;
     ResourceSnapshot latestResourceSnapshot() const;
     void setNpuContext(rknn_context context);
 
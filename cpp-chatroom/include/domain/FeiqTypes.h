@@ -28,6 +28,7 @@ struct FeiqFellowInfo {
     QString host;
     QString mac;
     bool online = false;
+    bool verified = true;   // false: 从缓存恢复，尚未收到对方回应
 };
 
 struct FeiqFileOffer {
@@ -37,6 +38,7 @@ struct FeiqFileOffer {
     QString localPath;
     qint64 fileSize = 0;
     quint32 fileType = 0;
+    bool inlineImage = false;   // 内嵌图片：自动下载，在聊天中直接显示
 };
 
 struct FeiqMessageContent {
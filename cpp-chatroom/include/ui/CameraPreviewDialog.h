@@ -23,6 +23,7 @@ class QLabel;
 class QComboBox;
 class QPushButton;
 class QLineEdit;
+class QCheckBox;
 class QTimer;
 class QCloseEvent;
 class QResizeEvent;
@@ -80,6 +81,8 @@ private slots:
     void onStreamingStopped();
     void onFrameSent(uint32_t frameId, int chunks);
     void onStreamError(const QString& error);
+    void onEncodeSettingsChanged(int jpegQuality, double scale, int maxFps);
+    void onSendRateUpdated(qint64 bitsPerSecond, int framesDropped);
 
 private:
     void initializeUi();
@@ -99,7 +102,7 @@ private:
     static GstFlowReturn onAppSinkNewSample(GstAppSink* sink, gpointer userData);
     
     // 发送当前帧到视频流
-    void sendFrameToStream(const QImage& image);
+    void sendFrameToStream(quint64 frameId, const QImage& image);
 
     struct VideoDevice {
         QString label;
@@ -125,8 +128,10 @@ private:
     
     // 视频推流
     QLineEdit* m_streamTargetEdit;
+    QCheckBox* m_streamLegacyCheck;     // 对方是只认v1分片头的旧版接收端
     QPushButton* m_streamButton;
     QLabel* m_streamStatusLabel;
+    QString m_streamStatusText;     // 目标和编码参数，发送速率附在其后
     VideoStreamer* m_videoStreamer;
     bool m_isStreaming;
 };
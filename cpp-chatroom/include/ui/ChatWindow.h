@@ -9,6 +9,10 @@
 #include <QString>
 #include <QUrl>
 #include <QVector>
+#include <QHash>
+#include <QMultiHash>
+#include <QImage>
+#include <QSize>
 #include "domain/FeiqTypes.h"
 
 class FeiqBackend;
@@ -34,6 +38,10 @@ public:
     void appendText(const QString& text, const QString& senderName, bool isOwn = false);
     void appendImage(const QString& imagePath, const QString& senderName, bool isOwn = false);
     void appendFileOffer(const FeiqFileOffer& offer, const QString& senderName);
+    // 好友发来的内嵌图片：先显示占位，下载完成后换成缩略图
+    void appendPendingImage(const FeiqFileOffer& offer, const QString& senderName);
+    // 内嵌图片已下载到offer.localPath，返回是否有对应的占位
+    bool completePendingImage(const FeiqFileOffer& offer);
     void appendEmoji(const QString& emoji, const QString& senderName, bool isOwn = false);
     static bool isEmojiMessage(const QString& message, QString* emojiOut = nullptr);
 
@@ -41,6 +49,7 @@ public:
 
 signals:
     void sendFileRequest(const QString& targetIp, const QString& filePath);
+    void sendImageRequest(const QString& targetIp, const QString& imagePath);
 
 protected:
     void closeEvent(QCloseEvent* event) override;
@@ -49,6 +58,7 @@ private slots:
     void onSendClicked();
     void onFileClicked();
     void onEmojiClicked();
+    void onThumbnailReady(const QString& path, const QSize& bound, const QImage& image);
 #ifdef BUILD_RK3566
     void onScreenshotClicked();
     void onCameraClicked();
@@ -57,10 +67,16 @@ private slots:
 
 private:
     void setupUI();
+    // 不属于任何一方的提示，显示为灰色的一行
+    void appendStatus(const QString& text);
     QString formatTextForDisplay(const QString& text);
     QString emojiTokenForIndex(int index) const;
     bool sendEmojiByIndex(int index);
     static const QVector<QString>& emojiList();
+    QUrl appendImagePlaceholder(const QString& senderName, bool isOwn);
+    void showImage(const QUrl& resource, const QString& imagePath);
+    void setImageResource(const QUrl& resource, const QImage& image);
+    QString imageKeyOf(const FeiqFileOffer& offer) const;
 
     QString m_ownUsername;
     FeiqFellowInfo m_targetFellow;
@@ -73,6 +89,10 @@ private:
     QPushButton* m_sendButton;
     QPushButton* m_fileButton;
     QPushButton* m_emojiButton;
+
+    int m_imageSeq = 0;
+    QMultiHash<QString, QUrl> m_thumbnailWaiters;  // 图片路径 -> 等待缩略图的占位
+    QHash<QString, QUrl> m_pendingImages;          // ip|packetNo|fileId -> 等待下载的占位
 #ifdef BUILD_RK3566
     QPushButton* m_screenshotButton;
     QPushButton* m_cameraButton;
@@ -6,6 +6,7 @@
 #include <QLineEdit>
 #include <QMainWindow>
 #include <QMap>
+#include <QHash>
 #include <QMenu>
 #include <QMenuBar>
 #include <QPointer>
@@ -52,6 +53,7 @@ private slots:
     void onSearchTextChanged(const QString& text);
     void onGroupMessageClicked();
     void onSendFileRequest(const QString& targetIp, const QString& filePath);
+    void onSendImageRequest(const QString& targetIp, const QString& imagePath);
     void onSettingsClicked();
     void onAboutClicked();
 #ifdef BUILD_RK3566
@@ -76,6 +78,7 @@ private:
     void updateUserList();
     void filterUserList();
     void openChatWindow(const QString& targetIp);
+    void handleInlineImageTask(const FeiqFileTaskInfo& info);
     void loadSettings();
     
     // UI组件
@@ -103,10 +106,18 @@ private:
     QString m_username;
     QString m_hostname;
     QString m_groupname;
+    QString m_multicastGroup;   // 为空表示不启用组播发现
+    int m_multicastTtl;
     
     FeiqBackend* m_backend;
     QMap<QString, FeiqFellowInfo> m_users;  // IP -> UserInfo
     QMap<QString, ChatWindow*> m_chatWindows;      // IP -> ChatWindow
+    struct DownloadedImage {
+        QString ip;
+        FeiqFileOffer file;
+        qint64 finishedAt = 0;  // 下载完成的时刻，消息迟迟不到的条目过期删除
+    };
+    QHash<QString, DownloadedImage> m_downloadedImages;  // 先于消息下载完的内嵌图片，ip|packetNo|fileId -> 文件
 #ifdef BUILD_RK3566
     QPointer<PerformanceAnalyticsDialog> m_performanceDialog;
 #endif
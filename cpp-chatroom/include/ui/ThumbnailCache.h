@@ -0,0 +1,42 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QImage>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+
+/**
+ * @brief 聊天图片缩略图：在线程池中按目标尺寸解码（QImageReader::setScaledSize，
+ * JPEG等格式可直接以缩小的分辨率解码），解码结果按路径和尺寸缓存，GUI线程不做解码
+ */
+class ThumbnailCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    static ThumbnailCache* instance();
+
+    // 缓存命中直接返回；否则返回空图并在后台解码，完成后发出thumbnailReady
+    QImage request(const QString& path, const QSize& bound);
+
+signals:
+    // 解码失败时image为空
+    void thumbnailReady(const QString& path, const QSize& bound, const QImage& image);
+
+private:
+    explicit ThumbnailCache(QObject* parent = nullptr);
+
+    static QString keyOf(const QString& path, const QSize& bound);
+    static QImage decode(const QString& path, const QSize& bound);
+    void finish(const QString& path, const QSize& bound, const QImage& image);
+
+    QCache<QString, QImage> m_cache;   // 开销按KB计
+    QSet<QString> m_pending;           // 正在解码的key，避免重复提交
+    QThreadPool m_pool;
+};
+
+#endif // THUMBNAILCACHE_H
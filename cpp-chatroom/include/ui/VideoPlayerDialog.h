@@ -33,11 +33,12 @@ private slots:
     void onListeningStarted(uint16_t port);
     void onListeningStopped();
     void onReceiveError(const QString& error);
-    void onStatsUpdated(int fps, int lostFrames);
+    void onStatsUpdated(int fps, int lostFrames, int latencyMs);
 
 private:
     void initializeUi();
     void updateDisplayedPixmap();
+    void updateReceiverDisplaySize();
 
     QLabel* m_videoLabel;
     QLabel* m_statusLabel;
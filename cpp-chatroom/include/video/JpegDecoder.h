@@ -0,0 +1,41 @@
+#ifndef JPEGDECODER_H
+#define JPEGDECODER_H
+
+#include <QImage>
+#include <QSize>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief 视频帧的JPEG解码器
+ *
+ * 按显示尺寸在DCT域缩小解码（1/2、1/4、1/8），只解出显示需要的分辨率。
+ * 有libjpeg-turbo时直接解码到复用的QImage缓冲；没有时用QImageReader的缩放解码。
+ * 不是线程安全的，每个解码线程各用一个。
+ */
+class JpegDecoder
+{
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    JpegDecoder(const JpegDecoder&) = delete;
+    JpegDecoder& operator=(const JpegDecoder&) = delete;
+
+    /**
+     * @brief 解码一帧
+     * @param data JPEG数据
+     * @param size 数据大小
+     * @param target 显示区域大小，结果不小于按比例放入其中的尺寸；为空时按原尺寸解码
+     * @return 解码结果，失败时为空图；上一次的结果已不再被引用时复用其缓冲
+     */
+    QImage decode(const uint8_t* data, size_t size, const QSize& target);
+
+private:
+    QImage decodeWithReader(const uint8_t* data, size_t size, const QSize& target);
+
+    void* m_handle = nullptr;   // tjhandle
+    QImage m_image;             // 解码缓冲，调用方释放引用后复用
+};
+
+#endif // JPEGDECODER_H
@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <utility>
+
+#include "ipmsg.h"
 
 /**
  * @brief 视频帧UDP包头结构
@@ -19,6 +22,67 @@ struct VideoChunkHeader {
     uint16_t totalChunks;   // 总分片数
     uint32_t payloadSize;   // 本包载荷大小
 };
+
+/**
+ * @brief 带帧元数据的分片头（v2）
+ *
+ * 魔数为VIDEO_FRAME_MAGIC_V2，每个分片都带完整的帧元数据，收到任意一个分片即可
+ * 知道帧的大小、分辨率和采集时间。以后的版本只在末尾追加字段并增大headerSize，
+ * 接收端按headerSize定位载荷，旧接收端可以忽略不认识的字段。
+ */
+struct VideoChunkHeaderV2 {
+    VideoChunkHeader base;      // 与v1相同的字段，magic为VIDEO_FRAME_MAGIC_V2
+    uint8_t version;            // VIDEO_PROTOCOL_VERSION
+    uint8_t codec;              // VIDEO_CODEC_JPEG
+    uint16_t headerSize;        // 整个分片头的长度
+    uint16_t width;             // 帧宽度
+    uint16_t height;            // 帧高度
+    uint32_t frameSize;         // 整帧数据大小
+    uint32_t streamId;          // 推流会话标识，推流端重新开始时帧ID从0计，接收端据此重置
+    uint64_t captureTimeMs;     // 采集时间，UTC毫秒
+};
+
+/**
+ * @brief XOR校验分片的载荷头
+ *
+ * 每groupSize个数据分片附带一个校验分片，chunkIndex为totalChunks+组号，
+ * totalChunks仍为数据分片数，旧的接收端会把校验分片当作越界分片忽略。
+ * 载荷为此头加上组内各数据分片（不足一个分片长度的补零）逐字节异或的结果，
+ * 组内缺一个数据分片时可据此恢复。
+ */
+struct VideoParityHeader {
+    uint32_t frameSize;     // 整帧JPEG大小，用于确定最后一个分片的长度
+    uint16_t groupSize;     // 每组数据分片数
+    uint16_t reserved;
+};
+
+/**
+ * @brief 重传请求包头
+ *
+ * 接收端在帧超时前发现缺少分片时，发回推流端，后跟count个uint16_t分片索引。
+ */
+struct VideoNackHeader {
+    uint32_t magic;         // VIDEO_NACK_MAGIC
+    uint32_t frameId;       // 缺分片的帧
+    uint16_t count;         // 请求重传的分片数
+    uint16_t reserved;
+};
+
+/**
+ * @brief 接收报告
+ *
+ * 接收端每个统计周期发回推流端一次，推流端据丢帧情况调整画质、分辨率和帧率。
+ */
+struct VideoReportPacket {
+    uint32_t magic;             // VIDEO_REPORT_MAGIC
+    uint32_t lastFrameId;       // 最近完成的帧
+    uint16_t intervalMs;        // 统计周期
+    uint16_t framesReceived;    // 周期内完成的帧数
+    uint16_t framesLost;        // 周期内超时丢弃的帧数
+    uint16_t chunksRecovered;   // 周期内由校验分片恢复的分片数
+    uint16_t chunksRequested;   // 周期内请求重传的分片数
+    uint16_t reserved;
+};
 #pragma pack(pop)
 
 /**
@@ -29,6 +93,19 @@ struct VideoFrameMeta {
     uint16_t width = 0;
     uint16_t height = 0;
     uint64_t timestamp = 0; // 毫秒时间戳
+    uint8_t codec = VIDEO_CODEC_JPEG;
+    uint32_t streamId = 0;
+};
+
+/**
+ * @brief 解析后的分片头，v1和v2统一表示
+ */
+struct VideoChunkInfo {
+    VideoChunkHeader header;
+    uint8_t version = 1;
+    size_t headerSize = 0;      // 载荷在包中的偏移
+    uint32_t frameSize = 0;     // 整帧大小，v1为0（未知）
+    VideoFrameMeta meta;        // v1只有frameId，其余为默认值
 };
 
 /**
@@ -42,7 +119,79 @@ struct VideoFramePacket {
 };
 
 /**
- * @brief 将JPEG帧数据拆分为UDP分包
+ * @brief 一个分片的描述：包头，以及指向原JPEG数据的载荷切片
+ *
+ * 发送时以gather I/O把包头的前header.headerSize字节和载荷拼成一个UDP包，载荷不复制。
+ * v2发出整个包头；v1只发出base部分，其余字段不上线路。
+ * 载荷指针只在原JPEG数据有效期间有效。
+ */
+struct VideoChunkView {
+    VideoChunkHeaderV2 header;
+    const uint8_t* payload = nullptr;
+    size_t payloadSize = 0;
+};
+
+/**
+ * @brief 将JPEG帧拆分为分片描述，不分配载荷也不复制
+ *
+ * @param meta 帧元数据，写入每个分片的v2分片头；v1只用到frameId
+ * @param data JPEG数据
+ * @param size 数据大小
+ * @param views 输出，先清空再填充；由调用方复用，避免每帧分配
+ * @param maxChunkSize 单包最大大小（含包头）
+ * @param version 分片头版本，1供只认v1的旧接收端使用
+ * @return 分片数，数据为空、版本不支持或分片数超出包头范围时返回0
+ */
+size_t splitFrameToChunkViews(
+    const VideoFrameMeta& meta,
+    const uint8_t* data,
+    size_t size,
+    std::vector<VideoChunkView>& views,
+    size_t maxChunkSize = 1400,
+    int version = VIDEO_PROTOCOL_VERSION
+);
+
+/**
+ * @brief 为已拆分的数据分片追加XOR校验分片
+ *
+ * @param views 数据分片描述，校验分片追加在末尾
+ * @param frameSize 整帧大小
+ * @param groupSize 每组数据分片数，冗余约为1/groupSize；0表示不加
+ * @param parity 校验数据的存放区，由调用方复用，校验分片的载荷指向其中
+ * @return 追加的校验分片数
+ */
+size_t appendParityChunks(
+    std::vector<VideoChunkView>& views,
+    size_t frameSize,
+    size_t groupSize,
+    std::vector<uint8_t>& parity
+);
+
+/**
+ * @brief 用校验分片恢复一组中唯一缺失的数据分片
+ *
+ * @param parityPayload 校验分片的载荷（含VideoParityHeader）
+ * @param paritySize 校验分片载荷大小
+ * @param others 组内其余数据分片的载荷
+ * @param missingIndex 缺失分片的索引
+ * @param totalChunks 数据分片总数
+ * @param out 输出恢复出的分片载荷
+ * @return 校验分片有效且恢复成功返回true
+ */
+bool recoverChunkFromParity(
+    const uint8_t* parityPayload,
+    size_t paritySize,
+    const std::vector<std::pair<const uint8_t*, size_t>>& others,
+    size_t missingIndex,
+    size_t totalChunks,
+    std::vector<uint8_t>& out
+);
+
+/**
+ * @brief 将JPEG帧数据拆分为v1格式的UDP分包
+ *
+ * 每个分包单独分配，包头为v1分片头，与旧版的输出相同。推流端已改用splitFrameToChunkViews，
+ * 此函数留给需要完整v1数据包的工具和测试。
  * 
  * @param frameId 帧ID
  * @param jpegData JPEG数据
@@ -60,9 +209,52 @@ std::vector<std::vector<uint8_t>> splitFrameToChunks(
  * 
  * @param data UDP数据
  * @param size 数据大小
- * @param header 输出头信息
+ * @param header 输出头信息，v2分片只输出与v1相同的部分
  * @return 解析成功返回true
  */
 bool parseChunkHeader(const uint8_t* data, size_t size, VideoChunkHeader& header);
 
+/**
+ * @brief 解析v1或v2分片头
+ *
+ * @param data UDP数据
+ * @param size 数据大小
+ * @param info 输出分片头和帧元数据
+ * @return 解析成功返回true，版本低于2或headerSize不合法的v2分片返回false
+ */
+bool parseChunk(const uint8_t* data, size_t size, VideoChunkInfo& info);
+
+/**
+ * @brief 构造重传请求包
+ *
+ * @param frameId 帧ID
+ * @param indexes 缺失的分片索引，超出单包容量的部分不写入
+ * @param packet 输出，由调用方复用
+ * @return 写入的分片索引数
+ */
+size_t buildNackPacket(uint32_t frameId, const std::vector<uint16_t>& indexes,
+                       std::vector<uint8_t>& packet);
+
+/**
+ * @brief 解析重传请求包
+ *
+ * @param data UDP数据
+ * @param size 数据大小
+ * @param frameId 输出帧ID
+ * @param indexes 输出请求重传的分片索引
+ * @return 解析成功返回true
+ */
+bool parseNackPacket(const uint8_t* data, size_t size, uint32_t& frameId,
+                     std::vector<uint16_t>& indexes);
+
+/**
+ * @brief 解析接收报告
+ *
+ * @param data UDP数据
+ * @param size 数据大小
+ * @param report 输出报告
+ * @return 解析成功返回true
+ */
+bool parseReportPacket(const uint8_t* data, size_t size, VideoReportPacket& report);
+
 #endif // VIDEOFRAME_H
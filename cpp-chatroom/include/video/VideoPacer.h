@@ -0,0 +1,107 @@
+#ifndef VIDEOPACER_H
+#define VIDEOPACER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "video/VideoFrame.h"
+
+/**
+ * @brief 视频分片的匀速发送线程
+ *
+ * 按令牌桶限速，把一帧的分片摊开在帧间隔内发出，避免整帧突发挤爆交换机和Wi-Fi的缓冲。
+ * 重传请求优先于新帧；积压的新帧超过上限时丢弃最旧的未开始帧，延迟不会无限增长。
+ * 分片载荷指向调用方的缓冲，排入时连同缓冲的引用一起交给本线程，发完或丢弃后才释放。
+ */
+class VideoPacer : public QThread
+{
+public:
+    using Buffer = std::shared_ptr<const std::vector<uint8_t>>;
+    // 实际发送一批分片，返回成功发出的分片数，在发送线程调用
+    using SendFunction = std::function<int(const std::vector<VideoChunkView>&)>;
+    // 一帧发送完成，sent为成功发出的分片数
+    using FrameDoneFunction = std::function<void(uint32_t frameId, int sent, int total)>;
+    // 每秒一次：实际发送速率和期间因积压丢弃的帧数
+    using StatsFunction = std::function<void(qint64 bitsPerSecond, int framesDropped)>;
+
+    VideoPacer(SendFunction send, FrameDoneFunction frameDone, StatsFunction stats,
+               QObject* parent = nullptr);
+    ~VideoPacer() override;
+
+    /**
+     * @brief 设置目标码率
+     * @param bitsPerSecond 每秒比特数，0表示不限速
+     */
+    void setTargetBitrate(qint64 bitsPerSecond);
+    qint64 targetBitrate() const;
+
+    /**
+     * @brief 排入一帧的分片
+     * @param chunks 取走其内容，换回一个用过的空vector供调用方复用
+     * @param data 数据分片载荷所在的缓冲
+     * @param parity 校验分片载荷所在的缓冲，没有校验分片时可为空
+     */
+    void enqueueFrame(uint32_t frameId, std::vector<VideoChunkView>& chunks,
+                      Buffer data, Buffer parity);
+
+    /**
+     * @brief 排入重传分片，排在所有新帧之前
+     * @param data 分片载荷所在的缓冲
+     */
+    void enqueueRetransmit(uint32_t frameId, std::vector<VideoChunkView>& chunks, Buffer data);
+
+    /**
+     * @brief 停止线程并丢弃未发出的分片
+     */
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    struct Job {
+        uint32_t frameId = 0;
+        bool retransmit = false;
+        std::vector<VideoChunkView> chunks;
+        Buffer data;    // 持有载荷所在的缓冲，调用方在此期间不会改写
+        Buffer parity;
+    };
+
+    void enqueue(std::deque<Job>& queue, uint32_t frameId, bool retransmit,
+                 std::vector<VideoChunkView>& chunks, Buffer data, Buffer parity);
+    // 回收分片数组并释放缓冲的引用
+    void recycle(Job& job);
+    void refillTokens();
+    // 统计周期已满时取出本周期的码率和丢帧数并开始新周期，须持有m_mutex
+    bool takeStats(qint64& bitsPerSecond, int& framesDropped);
+
+    SendFunction m_send;
+    FrameDoneFunction m_frameDone;
+    StatsFunction m_stats;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_wakeUp;
+    bool m_stopping = false;
+
+    std::deque<Job> m_frames;
+    std::deque<Job> m_retransmits;
+    std::vector<std::vector<VideoChunkView>> m_spare;   // 用过的分片数组，循环使用
+
+    qint64 m_bitrate = 0;
+    double m_tokens = 0;        // 当前可发送的字节数
+    qint64 m_lastRefillUs = 0;
+    QElapsedTimer m_clock;
+
+    qint64 m_windowBytes = 0;
+    int m_windowDropped = 0;
+    qint64 m_windowStartUs = 0;
+};
+
+#endif // VIDEOPACER_H
@@ -3,18 +3,28 @@
 
 #include <QObject>
 #include <QUdpSocket>
-#include <QTimer>
 #include <QMutex>
 #include <QImage>
-#include <map>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <array>
+#include <atomic>
+#include <deque>
 #include <vector>
 #include <cstdint>
 
+#include "video/VideoFrame.h"
+
+class QThread;
+class QTimer;
+
 /**
  * @brief 视频流接收端
  * 
  * 负责接收UDP分包、重组帧、解码JPEG并显示。
- * 运行在Ubuntu端。
+ * 运行在Ubuntu端。收包和重组在专用的接收线程中进行，JPEG在线程池中解码。
+ * 解码完的帧先进抖动缓冲，按帧时间戳换算出的播放时刻依次交给界面：缓冲延迟随
+ * 测得的抖动自适应，错过播放时刻的帧丢弃，画面不会往回播。
  */
 class VideoReceiver : public QObject
 {
@@ -41,6 +51,12 @@ public:
      */
     bool isListening() const { return m_listening; }
 
+    /**
+     * @brief 设置显示区域大小，帧按不小于放入其中所需的尺寸缩小解码
+     * @param size 物理像素大小，为空时按原尺寸解码
+     */
+    void setDisplaySize(const QSize& size);
+
 signals:
     /**
      * @brief 收到完整帧信号
@@ -67,39 +83,142 @@ signals:
 
     /**
      * @brief 统计信息
+     * @param latencyMs 期间显示的帧从时间戳到显示的平均延迟（毫秒），没有显示帧时为-1
      */
-    void statsUpdated(int fps, int lostFrames);
-
-private slots:
-    void onReadyRead();
-    void onTimeoutCheck();
+    void statsUpdated(int fps, int lostFrames, int latencyMs);
 
 private:
-    struct FrameBuffer {
+    /**
+     * @brief 一帧的重组槽，按帧ID取模放在固定的环中，帧间复用
+     *
+     * 非末尾的数据分片长度相同，直接写入连续的data中索引×分片长度处；
+     * 末尾分片长度不定，先放在tail，收齐时接到data末尾，随后直接从data解码。
+     */
+    struct FrameSlot {
+        // Decoding：收齐后等待或正在解码，数据不可覆盖；Closed：已解码或已超时，迟到的分片忽略
+        enum class State { Free, Assembling, Decoding, Closed };
+
+        State state = State::Free;
         uint32_t frameId = 0;
+        uint32_t streamId = 0;
+        uint32_t session = 0;                       // 占用槽位时的m_session
         uint16_t totalChunks = 0;
-        std::vector<std::vector<uint8_t>> chunks;
-        std::vector<bool> received;
+        uint16_t receivedCount = 0;
+        size_t stride = 0;                          // 非末尾分片的长度，收到第一个后确定
+        std::vector<uint8_t> data;                  // 只增不减，不每帧分配
+        std::vector<uint8_t> tail;                  // 末尾分片
+        size_t frameSize = 0;                       // 收齐后的整帧大小
+        std::vector<uint64_t> receivedBits;         // 每位对应一个数据分片
+        std::vector<std::vector<uint8_t>> parity;   // 按组号存放的校验分片
+        uint16_t groupSize = 0;                     // 收到校验分片后才知道
+        uint64_t timestamp = 0;     // 帧时间戳（毫秒）：v2为推流端的采集时间，v1为首个分片到达的本地时间
         qint64 firstChunkTime = 0;
+        qint64 lastChunkTime = 0;
+        qint64 lastNackTime = 0;
+        int nackRounds = 0;
         QString senderIp;
-
-        bool isComplete() const;
-        std::vector<uint8_t> assemble() const;
+        QHostAddress senderAddress;
+        quint16 senderPort = 0;     // 推流端的源端口，重传请求发往此处
+
+        // expectedSize为v2分片头中的整帧大小，0表示未知
+        void reset(uint32_t id, uint16_t chunks, size_t expectedSize);
+        bool has(size_t index) const;
+        bool isComplete() const { return receivedCount == totalChunks; }
+        bool store(size_t index, const uint8_t* payload, size_t size);
+        const uint8_t* chunkData(size_t index) const;
+        size_t chunkSize(size_t index) const;
+        // 收齐后把末尾分片接到data后面
+        void finish();
+        const uint8_t* frameData() const { return totalChunks == 1 ? tail.data() : data.data(); }
+        std::vector<uint16_t> missingChunks() const;
+        void storeParity(uint16_t group, const uint8_t* payload, size_t size);
+        bool tryRecover(uint16_t group, std::vector<uint8_t>& scratch);
     };
 
-    void processChunk(const QHostAddress& sender, const QByteArray& data);
-    void completeFrame(uint32_t frameId);
-    void cleanupOldFrames();
+    // 以下在接收线程中运行
+    void receiveLoop(uint16_t port);
+    void receivePending(QUdpSocket& socket);
+    void processChunk(const QHostAddress& sender, quint16 senderPort, const uint8_t* data, size_t size);
+    // v1分片没有推流会话号，按帧ID回退或长时间停顿判断推流端是否重新开始
+    bool isStreamRestart(uint32_t frameId, qint64 now) const;
+    void resetStream(uint32_t streamId);
+    void checkTimeouts(qint64 now);
+    void requestMissingChunks(qint64 now);
+    void sendReport(int framesReceived, int framesLost, qint64 intervalMs);
+
+    /**
+     * @brief 解码完、等待播放的帧
+     */
+    struct BufferedFrame {
+        VideoFrameMeta meta;
+        QImage image;
+        QString senderIp;
+        qint64 baseTime = 0;    // 时间戳换算到本地时钟的时刻，加上缓冲延迟即播放时刻
+    };
 
-    QUdpSocket* m_socket = nullptr;
-    QTimer* m_timeoutTimer = nullptr;
+    // 在解码线程中运行，解码后放入抖动缓冲
+    void decodeFrame(size_t index, uint32_t frameId);
+    // 以下调用时需持有m_mutex
+    bool isTooLate(uint32_t frameId, uint64_t timestamp, qint64 now) const;
+    void enqueuePlayout(const VideoFrameMeta& meta, const QImage& image, const QString& senderIp, qint64 now);
+    void updateClockOffset(qint64 offset, qint64 now);
+    void updatePlayoutDelay(qint64 readyDelay);
+    // 以下在本对象所在线程运行：按最早一帧的播放时刻定时，到时发出到期的最新一帧
+    void schedulePlayout();
+    void playDueFrames();
+
+    QThread* m_receiveThread = nullptr;
+    QUdpSocket* m_socket = nullptr;     // 接收线程中的套接字，只在该线程使用
+    std::atomic<bool> m_stopping{false};
+    QSemaphore m_bindDone;
+    bool m_bindOk = false;
+    QString m_bindError;
     bool m_listening = false;
     QMutex m_mutex;
-
-    std::map<uint32_t, FrameBuffer> m_frameBuffers;
+    QThreadPool m_decodePool;
+    QSize m_displaySize;
+
+    // 30fps下帧重组时限内最多有三四帧在途，槽位留足余量
+    static constexpr size_t kFrameSlots = 8;
+    std::array<FrameSlot, kFrameSlots> m_slots;
+    QByteArray m_datagram;              // 接收缓冲，复用
+    std::vector<uint8_t> m_recvBuffers; // recvmmsg的批量接收缓冲
+    std::vector<uint8_t> m_recovered;   // 由校验分片恢复的分片，复用
+
+    uint32_t m_streamId = 0;            // 当前推流会话，v1分片为0
+    uint32_t m_session = 0;             // 每次resetStream加一，v1重新推流时会话号不变，靠它区分新旧槽位
+    uint32_t m_newestFrameId = 0;       // 本会话见过的最新帧
+    bool m_hasNewestFrame = false;
+    qint64 m_lastChunkTime = 0;         // 最近一个分片到达的时间
     uint32_t m_lastCompletedFrame = 0;
     int m_framesReceived = 0;
     int m_framesLost = 0;
+    int m_chunksRecovered = 0;  // 由校验分片恢复的分片数
+    int m_chunksRequested = 0;  // 请求重传的分片数
+    int m_framesSkipped = 0;    // 来不及播放、不再解码的帧数
+    int m_framesLate = 0;       // 解码完但错过播放时刻而丢弃的帧数
+
+    // 抖动缓冲，按帧ID排序
+    std::deque<BufferedFrame> m_jitterBuffer;
+    QTimer* m_playoutTimer = nullptr;
+    bool m_playoutQueued = false;
+    uint32_t m_lastPlayedFrame = 0;
+    bool m_hasPlayed = false;
+    // 播放时钟：本地时间减帧时间戳的最小值，即最快的一帧从时间戳到解码完成所用的时间
+    bool m_hasClockOffset = false;
+    qint64 m_clockOffset = 0;
+    qint64 m_windowClockOffset = 0;     // 当前统计窗口内的最小值
+    qint64 m_clockWindowStart = 0;
+    // 帧比最快的一帧晚解码完成的时间，其均值和平均偏差决定缓冲延迟
+    double m_readyDelayMean = 0;
+    double m_readyDelayDeviation = 0;
+    qint64 m_playoutDelayMs = 0;
+    qint64 m_latencySum = 0;
+    int m_latencyCount = 0;
+
+    std::vector<uint8_t> m_nackPacket;
+    QHostAddress m_streamerAddress;     // 最近一个分片的来源，接收报告发往此处
+    quint16 m_streamerPort = 0;
     qint64 m_lastStatsTime = 0;
 };
 
@@ -5,10 +5,17 @@
 #include <QUdpSocket>
 #include <QHostAddress>
 #include <QMutex>
+#include <QElapsedTimer>
+#include <array>
 #include <atomic>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+#include "video/VideoFrame.h"
+
+class VideoPacer;
+
 /**
  * @brief 视频流发送端
  * 
@@ -20,6 +27,15 @@ class VideoStreamer : public QObject
     Q_OBJECT
 
 public:
+    /**
+     * @brief 编码参数，由接收端的报告自动调整
+     */
+    struct EncodeSettings {
+        int jpegQuality = 80;
+        double scale = 1.0;     // 相对原图的缩放
+        int maxFps = 0;         // 0表示不限
+    };
+
     explicit VideoStreamer(QObject* parent = nullptr);
     ~VideoStreamer();
 
@@ -46,9 +62,48 @@ public:
      * @param jpegData JPEG编码数据
      * @param width 帧宽度
      * @param height 帧高度
+     * @param captureTimeMs 采集时间（UTC毫秒），0表示取当前时间
      * @return 发送成功返回true
      */
-    bool sendFrame(const std::vector<uint8_t>& jpegData, uint16_t width, uint16_t height);
+    bool sendFrame(const std::vector<uint8_t>& jpegData, uint16_t width, uint16_t height,
+                   qint64 captureTimeMs = 0);
+
+    /**
+     * @brief 设置前向纠错：每groupSize个数据分片附带一个XOR校验分片
+     * @param groupSize 冗余约为1/groupSize，组内丢一个分片可由接收端直接恢复；0表示关闭
+     */
+    void setFecGroupSize(int groupSize) { m_fecGroupSize = groupSize > 0 ? groupSize : 0; }
+    int fecGroupSize() const { return m_fecGroupSize; }
+
+    /**
+     * @brief 设置分片头版本，下一帧起生效
+     * @param version 默认VIDEO_PROTOCOL_VERSION；1发v1分片头，供只认v1的旧接收端使用，
+     *                不带采集时间和推流会话，接收端按到达时间播放
+     */
+    void setProtocolVersion(int version) { m_protocolVersion = version == 1 ? 1 : VIDEO_PROTOCOL_VERSION; }
+    int protocolVersion() const { return m_protocolVersion; }
+
+    /**
+     * @brief 设置目标码率，分片按此速率匀速发出，不再整帧突发
+     * @param bitsPerSecond 每秒比特数，0表示不限速
+     */
+    void setTargetBitrate(qint64 bitsPerSecond);
+    qint64 targetBitrate() const { return m_targetBitrate; }
+
+    /**
+     * @brief 最近一秒实际发送的速率（比特每秒）
+     */
+    qint64 sendRate() const { return m_sendRate; }
+
+    /**
+     * @brief 当前应使用的编码参数，调用方编码前读取
+     */
+    EncodeSettings encodeSettings() const;
+
+    /**
+     * @brief 按当前帧率上限决定这一帧是否发送，调用方在编码前询问，被跳过的帧不必编码
+     */
+    bool shouldSendFrame();
 
     /**
      * @brief 获取当前目标IP
@@ -60,15 +115,74 @@ signals:
     void streamingStopped();
     void frameSent(uint32_t frameId, int chunks);
     void sendError(const QString& error);
+    void encodeSettingsChanged(int jpegQuality, double scale, int maxFps);
+    // 每秒一次，由发送线程发出；framesDropped为因积压未发出的帧数
+    void sendRateUpdated(qint64 bitsPerSecond, int framesDropped);
+
+private slots:
+    void onFeedbackReadyRead();
 
 private:
+    /**
+     * @brief 最近发出的帧，用于响应接收端的重传请求
+     */
+    struct SentFrame {
+        VideoFrameMeta meta;
+        bool valid = false;
+        size_t maxChunkSize = 0;        // 按发送时的分片大小和版本重新拆分，索引才对得上
+        int version = VIDEO_PROTOCOL_VERSION;
+        // 发送线程的作业也持有这两个缓冲；没有作业引用时环中复用，不每帧分配
+        std::shared_ptr<std::vector<uint8_t>> data;
+        std::shared_ptr<std::vector<uint8_t>> parity;   // 校验分片的载荷
+    };
+
+    void retransmit(uint32_t frameId, const std::vector<uint16_t>& indexes);
+    /**
+     * @brief 据接收报告调整画质档位：拥塞时一次降两档，连续几个周期无损后升一档
+     */
+    void onReport(const VideoReportPacket& report);
+
+    /**
+     * @brief 发送一批分片，Linux下用sendmmsg批量提交，包头和载荷以iovec拼接
+     * 在发送线程中调用
+     * @return 成功发出的分片数
+     */
+    int sendChunks(const std::vector<VideoChunkView>& views);
+    int sendChunksFallback(const std::vector<VideoChunkView>& views);
+
     QUdpSocket* m_socket = nullptr;
     QHostAddress m_targetAddress;
     uint16_t m_targetPort = 2426;
     QString m_targetIp;
     std::atomic<bool> m_streaming{false};
     std::atomic<uint32_t> m_frameId{0};
+    uint32_t m_streamId = 0;                    // 每次开始推流时随机生成
     QMutex m_mutex;
+    QMutex m_socketMutex;                       // 发送线程与本线程共用套接字时加锁
+    VideoPacer* m_pacer = nullptr;
+    qint64 m_targetBitrate = 0;
+    std::atomic<qint64> m_sendRate{0};
+
+    std::vector<VideoChunkView> m_chunkViews;   // 每帧复用
+    std::vector<uint8_t> m_datagram;            // 无法gather发送时拼包用，仅发送线程使用
+    std::vector<uint8_t> m_feedback;            // 接收重传请求和接收报告
+    std::atomic<int> m_fecGroupSize{0};
+    std::atomic<int> m_protocolVersion{VIDEO_PROTOCOL_VERSION};
+
+    // 保留约半秒的帧，超过接收端的重组时限后重传已无意义
+    static constexpr size_t kRetransmitFrames = 16;
+    std::array<SentFrame, kRetransmitFrames> m_sentFrames;
+    std::vector<VideoChunkView> m_retransmitViews;
+    std::vector<uint16_t> m_nackIndexes;
+    int m_chunksRetransmitted = 0;
+
+    // 码率控制，档位越高画质越低
+    int m_qualityLevel = 0;
+    int m_cleanReports = 0;         // 连续无损的报告数
+    int m_windowFramesSent = 0;     // 上次报告以来发出的帧数
+    int m_windowChunksSent = 0;     // 上次报告以来发出的分片数
+    QElapsedTimer m_frameClock;
+    qint64 m_nextFrameDueMs = 0;
 };
 
 #endif // VIDEOSTREAMER_H
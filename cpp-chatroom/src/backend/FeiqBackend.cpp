@@ -5,6 +5,8 @@
 #include <QFileInfo>
 #include <QTimer>
 #include <QFile>
+#include <QDir>
+#include <QStandardPaths>
 
 #include "feiqmodel.h"
 #include "content.h"
@@ -22,6 +24,10 @@ void registerMeta(const char* name)
 }
 
 const QString kEmojiPrefix = QStringLiteral(":emoji:");
+// 按内容缓存收到的文件，KyLink好友转发相同文件时免于重复下载
+const uint64_t kBlobCacheBytes = 512ull * 1024 * 1024;
+// 自动下载的内嵌图片，超出时删除最早的
+const uint64_t kImageCacheBytes = 256ull * 1024 * 1024;
 
 } // namespace
 
@@ -66,6 +72,21 @@ bool FeiqBackend::start()
         return true;
     }
 
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!cacheDir.isEmpty() && QDir().mkpath(cacheDir)) {
+        m_engine.setFellowCachePath(QDir(cacheDir).filePath(QStringLiteral("fellows.cache")).toStdString());
+
+        const QString blobDir = QDir(cacheDir).filePath(QStringLiteral("blobs"));
+        if (QDir().mkpath(blobDir)) {
+            m_engine.setBlobStore(blobDir.toStdString(), kBlobCacheBytes);
+        }
+
+        const QString imageDir = QDir(cacheDir).filePath(QStringLiteral("images"));
+        if (QDir().mkpath(imageDir)) {
+            m_engine.setImageDir(imageDir.toStdString(), kImageCacheBytes);
+        }
+    }
+
     auto result = m_engine.start();
     if (!result.first) {
         emit engineError(QString::fromStdString(result.second));
@@ -93,10 +114,23 @@ void FeiqBackend::enableIntervalDetect(int seconds)
     }
 }
 
+bool FeiqBackend::enableMulticastDiscovery(const QString& group, int ttl, QString* error)
+{
+    if (!m_running || group.isEmpty()) {
+        return false;
+    }
+
+    auto result = m_engine.enableMulticastDiscovery(group.toStdString(), ttl);
+    if (!result.first && error) {
+        *error = QString::fromStdString(result.second);
+    }
+    return result.first;
+}
+
 QList<FeiqFellowInfo> FeiqBackend::fellows() const
 {
     QList<FeiqFellowInfo> list;
-    auto fellows = m_engine.getModel().searchFellow("");
+    auto fellows = m_engine.getModel().onlineFellows();
     for (const auto& f : fellows) {
         list.append(toFellowInfo(f));
     }
@@ -175,6 +209,31 @@ bool FeiqBackend::sendFiles(const QString& ip, const QStringList& filePaths, QSt
     return true;
 }
 
+bool FeiqBackend::sendImage(const QString& ip, const QString& imagePath, QString* error)
+{
+    if (isTestUser(ip)) {
+        return handleTestUserSendFiles(QStringList{imagePath}, error);
+    }
+
+    auto content = FileContent::createFileContentToSend(imagePath.toStdString());
+    if (!content) {
+        if (error) {
+            *error = tr("无法读取图片: %1").arg(imagePath);
+        }
+        return false;
+    }
+    content->inlineImage = true;
+
+    auto result = m_engine.send(ensureFellow(ip), std::shared_ptr<FileContent>(content.release()));
+    if (!result.first) {
+        if (error) {
+            *error = QString::fromStdString(result.second);
+        }
+        return false;
+    }
+    return true;
+}
+
 bool FeiqBackend::acceptFile(const QString& ip, quint32 packetNo, quint32 fileId, const QString& savePath, QString* error)
 {
     if (isTestUser(ip)) {
@@ -273,6 +332,7 @@ FeiqFellowInfo FeiqBackend::toFellowInfo(const std::shared_ptr<Fellow>& fellow)
     info.host = QString::fromStdString(fellow->getHost());
     info.mac = QString::fromStdString(fellow->getMac());
     info.online = fellow->isOnLine();
+    info.verified = fellow->isVerified();
     return info;
 }
 
@@ -330,6 +390,7 @@ FeiqFileOffer FeiqBackend::toFileOffer(const std::shared_ptr<FileContent>& file)
     offer.localPath = QString::fromStdString(file->path);
     offer.fileSize = file->size;
     offer.fileType = file->fileType;
+    offer.inlineImage = file->inlineImage;
     return offer;
 }
 
@@ -402,6 +463,9 @@ void FeiqBackend::handleSendTimeoutEvent(const std::shared_ptr<SendTimeoEvent>&
     if (event->content && event->content->type() == ContentType::Text) {
         auto text = std::static_pointer_cast<TextContent>(event->content);
         description = tr("消息发送超时: %1").arg(QString::fromStdString(text->text));
+    } else if (event->content && event->content->type() == ContentType::File) {
+        auto file = std::static_pointer_cast<FileContent>(event->content);
+        description = tr("文件发送失败: %1").arg(QString::fromStdString(file->filename));
     } else {
         description = tr("消息发送超时");
     }
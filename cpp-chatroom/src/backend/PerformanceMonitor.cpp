@@ -218,6 +218,15 @@ void PerformanceMonitor::recordRenderStage(quint64 frameId,
     emit frameMetricsUpdated(summary, historyCopy);
 }
 
+qint64 PerformanceMonitor::frameCaptureAgeUs(quint64 frameId) const {
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_pendingFrames.find(frameId);
+    if (it == m_pendingFrames.end() || it->second.captureTimestampNs <= 0) {
+        return -1;
+    }
+    return (steadyNowNs() - it->second.captureTimestampNs) / 1000;
+}
+
 QVector<PerformanceMonitor::FrameTimings> PerformanceMonitor::recentFrameHistory(int maxSamples) const {
     QMutexLocker locker(&m_mutex);
     QVector<FrameTimings> historyCopy;
@@ -5,9 +5,11 @@
 #include "npu/YoloV5Runner.h"
 #include "video/VideoStreamer.h"
 
+#include <QCheckBox>
 #include <QCloseEvent>
 #include <QComboBox>
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QDir>
 #include <QDebug>
 #include <QHBoxLayout>
@@ -374,6 +376,7 @@ CameraPreviewDialog::CameraPreviewDialog(QWidget* parent)
     , m_detectionThread(nullptr)
     , m_detectionWorker(nullptr)
     , m_streamTargetEdit(nullptr)
+    , m_streamLegacyCheck(nullptr)
     , m_streamButton(nullptr)
     , m_streamStatusLabel(nullptr)
     , m_videoStreamer(nullptr)
@@ -442,11 +445,14 @@ void CameraPreviewDialog::initializeUi()
     auto* streamLabel = new QLabel(tr("推流目标IP:"), this);
     m_streamTargetEdit = new QLineEdit(this);
     m_streamTargetEdit->setPlaceholderText(tr("例如: 192.168.1.100"));
+    m_streamLegacyCheck = new QCheckBox(tr("兼容旧版接收端"), this);
+    m_streamLegacyCheck->setToolTip(tr("以v1分片头推流，旧版接收端才能识别；不带采集时间，延迟统计不可用"));
     m_streamButton = new QPushButton(tr("开始推流"), this);
     m_streamStatusLabel = new QLabel(tr("未推流"), this);
     
     streamLayout->addWidget(streamLabel);
     streamLayout->addWidget(m_streamTargetEdit, 1);
+    streamLayout->addWidget(m_streamLegacyCheck);
     streamLayout->addWidget(m_streamButton);
     streamLayout->addWidget(m_streamStatusLabel);
 
@@ -957,7 +963,7 @@ void CameraPreviewDialog::onInferenceFrameReady(quint64 frameId, const QImage& i
     updateStatusText(tr("预览中 - 目标 %1, 推理 %2 ms").arg(objectCount).arg(inferenceTimeMs));
 
     // 如果正在推流，发送当前帧
-    sendFrameToStream(image);
+    sendFrameToStream(frameId, image);
 
     const auto renderEnd = std::chrono::steady_clock::now();
     const qint64 renderDurationUs = std::chrono::duration_cast<std::chrono::microseconds>(renderEnd - renderStart).count();
@@ -1125,8 +1131,15 @@ void CameraPreviewDialog::onStreamClicked()
                     this, &CameraPreviewDialog::onFrameSent);
             connect(m_videoStreamer, &VideoStreamer::sendError,
                     this, &CameraPreviewDialog::onStreamError);
+            connect(m_videoStreamer, &VideoStreamer::encodeSettingsChanged,
+                    this, &CameraPreviewDialog::onEncodeSettingsChanged);
+            connect(m_videoStreamer, &VideoStreamer::sendRateUpdated,
+                    this, &CameraPreviewDialog::onSendRateUpdated);
+            // 约10%的冗余，Wi-Fi下零星丢包不至于丢掉整帧
+            m_videoStreamer->setFecGroupSize(10);
         }
         
+        m_videoStreamer->setProtocolVersion(m_streamLegacyCheck->isChecked() ? 1 : VIDEO_PROTOCOL_VERSION);
         if (!m_videoStreamer->startStreaming(targetIp)) {
             updateStatusText(tr("无法开始推流"));
             return;
@@ -1139,7 +1152,9 @@ void CameraPreviewDialog::onStreamingStarted(const QString& targetIp)
     m_isStreaming = true;
     m_streamButton->setText(tr("停止推流"));
     m_streamTargetEdit->setEnabled(false);
-    m_streamStatusLabel->setText(tr("推流中: %1").arg(targetIp));
+    m_streamLegacyCheck->setEnabled(false);
+    m_streamStatusText = tr("推流中: %1").arg(targetIp);
+    m_streamStatusLabel->setText(m_streamStatusText);
     m_streamStatusLabel->setStyleSheet("color: green;");
     updateStatusText(tr("开始向 %1 推送视频流").arg(targetIp));
 }
@@ -1149,6 +1164,7 @@ void CameraPreviewDialog::onStreamingStopped()
     m_isStreaming = false;
     m_streamButton->setText(tr("开始推流"));
     m_streamTargetEdit->setEnabled(true);
+    m_streamLegacyCheck->setEnabled(true);
     m_streamStatusLabel->setText(tr("未推流"));
     m_streamStatusLabel->setStyleSheet("");
     updateStatusText(tr("视频推流已停止"));
@@ -1166,17 +1182,66 @@ void CameraPreviewDialog::onStreamError(const QString& error)
     updateStatusText(tr("推流错误: %1").arg(error));
 }
 
-void CameraPreviewDialog::sendFrameToStream(const QImage& image)
+void CameraPreviewDialog::onEncodeSettingsChanged(int jpegQuality, double scale, int maxFps)
+{
+    if (!m_isStreaming || !m_videoStreamer) {
+        return;
+    }
+
+    m_streamStatusText = tr("推流中: %1 (质量 %2, %3%)")
+                             .arg(m_videoStreamer->targetIp())
+                             .arg(jpegQuality)
+                             .arg(qRound(scale * 100));
+    if (maxFps > 0) {
+        m_streamStatusText += tr(" %1fps").arg(maxFps);
+    }
+    m_streamStatusLabel->setText(m_streamStatusText);
+}
+
+void CameraPreviewDialog::onSendRateUpdated(qint64 bitsPerSecond, int framesDropped)
+{
+    if (!m_isStreaming) {
+        return;
+    }
+
+    QString text = m_streamStatusText + tr(" %1 Mbps").arg(bitsPerSecond / 1e6, 0, 'f', 1);
+    if (framesDropped > 0) {
+        text += tr(" 丢弃 %1 帧").arg(framesDropped);
+    }
+    m_streamStatusLabel->setText(text);
+}
+
+void CameraPreviewDialog::sendFrameToStream(quint64 frameId, const QImage& image)
 {
     if (!m_isStreaming || !m_videoStreamer || image.isNull()) {
         return;
     }
+
+    // 采集时间记在单调时钟上，换算成墙上时钟随帧发出，接收端据此算采集到显示的延迟
+    qint64 captureTimeMs = QDateTime::currentMSecsSinceEpoch();
+    const qint64 captureAgeUs = PerformanceMonitor::instance()->frameCaptureAgeUs(frameId);
+    if (captureAgeUs > 0) {
+        captureTimeMs -= captureAgeUs / 1000;
+    }
+
+    // 链路变差时推流端限制帧率，被跳过的帧不编码
+    if (!m_videoStreamer->shouldSendFrame()) {
+        return;
+    }
+
+    const VideoStreamer::EncodeSettings settings = m_videoStreamer->encodeSettings();
+    QImage frame = image;
+    if (settings.scale < 1.0) {
+        frame = image.scaled(qRound(image.width() * settings.scale),
+                             qRound(image.height() * settings.scale),
+                             Qt::KeepAspectRatio, Qt::FastTransformation);
+    }
     
     // 将 QImage 编码为 JPEG
     QByteArray jpegData;
     QBuffer buffer(&jpegData);
     buffer.open(QIODevice::WriteOnly);
-    if (!image.save(&buffer, "JPEG", 80)) { // 80% 质量
+    if (!frame.save(&buffer, "JPEG", settings.jpegQuality)) {
         return;
     }
     
@@ -1184,8 +1249,9 @@ void CameraPreviewDialog::sendFrameToStream(const QImage& image)
     std::vector<uint8_t> data(jpegData.constData(), 
                                jpegData.constData() + jpegData.size());
     m_videoStreamer->sendFrame(data, 
-                                static_cast<uint16_t>(image.width()),
-                                static_cast<uint16_t>(image.height()));
+                                static_cast<uint16_t>(frame.width()),
+                                static_cast<uint16_t>(frame.height()),
+                                captureTimeMs);
 }
 
 #include "CameraPreviewDialog.moc"
@@ -5,6 +5,7 @@
 #include "ui/CameraPreviewDialog.h"
 #endif
 #include "backend/FeiqBackend.h"
+#include "ui/ThumbnailCache.h"
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QCloseEvent>
@@ -14,6 +15,8 @@
 #include <QImageReader>
 #include <QTextImageFormat>
 #include <QTextCursor>
+#include <QTextDocument>
+#include <QColor>
 #include <QFileInfo>
 #include <QApplication>
 #include <QTimer>
@@ -36,6 +39,9 @@ QString displayNameOf(const FeiqFellowInfo& fellow)
 }
 
 const QString kEmojiPrefix = QStringLiteral(":emoji:");
+// 聊天中图片显示的最大尺寸，原图在后台按此尺寸解码
+const QSize kThumbnailBound(320, 240);
+const QSize kPlaceholderSize(160, 120);
 
 const QVector<QString>& emojiChoices()
 {
@@ -82,6 +88,9 @@ ChatWindow::ChatWindow(const QString& ownUsername,
     setGeometry(300, 300, 500, 400);
     
     setupUI();
+
+    connect(ThumbnailCache::instance(), &ThumbnailCache::thumbnailReady,
+            this, &ChatWindow::onThumbnailReady);
 }
 
 ChatWindow::~ChatWindow() = default;
@@ -155,6 +164,12 @@ void ChatWindow::appendText(const QString& text, const QString& senderName, bool
     m_messageDisplay->append(fullHtml);
 }
 
+void ChatWindow::appendStatus(const QString& text)
+{
+    m_messageDisplay->append(QString("<p style=\"color: gray;\"><i>%1</i></p>")
+        .arg(formatTextForDisplay(text)));
+}
+
 QString ChatWindow::formatTextForDisplay(const QString& text)
 {
     QString formatted = text;
@@ -205,11 +220,11 @@ void ChatWindow::onFileClicked()
 
     if (isImage) {
         appendImage(filePath, m_ownUsername, true);
+        emit sendImageRequest(m_targetIp, filePath);
     } else {
         appendText(tr("已发送文件: %1").arg(fileInfo.fileName()), m_ownUsername, true);
+        emit sendFileRequest(m_targetIp, filePath);
     }
-
-    emit sendFileRequest(m_targetIp, filePath);
 }
 
 void ChatWindow::onEmojiClicked()
@@ -303,11 +318,33 @@ void ChatWindow::onScreenshotTaken(const QString& filePath)
     
     // 显示截图并发送
     appendImage(filePath, m_ownUsername, true);
-    emit sendFileRequest(m_targetIp, filePath);
+    emit sendImageRequest(m_targetIp, filePath);
 }
 #endif
 
 void ChatWindow::appendImage(const QString& imagePath, const QString& senderName, bool isOwn)
+{
+    showImage(appendImagePlaceholder(senderName, isOwn), imagePath);
+}
+
+void ChatWindow::appendPendingImage(const FeiqFileOffer& offer, const QString& senderName)
+{
+    m_pendingImages.insert(imageKeyOf(offer), appendImagePlaceholder(senderName, false));
+}
+
+bool ChatWindow::completePendingImage(const FeiqFileOffer& offer)
+{
+    auto it = m_pendingImages.find(imageKeyOf(offer));
+    if (it == m_pendingImages.end()) {
+        return false;
+    }
+
+    showImage(it.value(), offer.localPath);
+    m_pendingImages.erase(it);
+    return true;
+}
+
+QUrl ChatWindow::appendImagePlaceholder(const QString& senderName, bool isOwn)
 {
     QString header;
     if (isOwn) {
@@ -317,14 +354,63 @@ void ChatWindow::appendImage(const QString& imagePath, const QString& senderName
         header = QString("<p style=\"color: blue;\"><b>%1 发送了图片:</b></p>")
             .arg(senderName);
     }
-    
-    QUrl imageUrl = QUrl::fromLocalFile(QFileInfo(imagePath).absoluteFilePath());
+
+    // 图片以文档资源的形式显示，解码完成后替换资源即可，不用重新插入内容
+    const QUrl resource(QStringLiteral("kythumb://%1").arg(++m_imageSeq));
+    QImage placeholder(kPlaceholderSize, QImage::Format_RGB32);
+    placeholder.fill(QColor(230, 230, 230));
+    m_messageDisplay->document()->addResource(QTextDocument::ImageResource, resource, placeholder);
+
     QString imageHtml = QString("<div style=\"margin-left: 10px;\"><img src=\"%1\"></div>")
-                            .arg(imageUrl.toString());
+                            .arg(resource.toString());
 
     m_messageDisplay->append(header + imageHtml);
     m_messageDisplay->append("");
     m_messageDisplay->ensureCursorVisible();
+    return resource;
+}
+
+void ChatWindow::showImage(const QUrl& resource, const QString& imagePath)
+{
+    const QImage cached = ThumbnailCache::instance()->request(imagePath, kThumbnailBound);
+    if (!cached.isNull()) {
+        setImageResource(resource, cached);
+        return;
+    }
+    m_thumbnailWaiters.insert(imagePath, resource);
+}
+
+void ChatWindow::onThumbnailReady(const QString& path, const QSize& bound, const QImage& image)
+{
+    if (bound != kThumbnailBound || !m_thumbnailWaiters.contains(path)) {
+        return;
+    }
+
+    const auto resources = m_thumbnailWaiters.values(path);
+    m_thumbnailWaiters.remove(path);
+
+    if (image.isNull()) {
+        appendStatus(tr("无法显示图片: %1").arg(QFileInfo(path).fileName()));
+        return;
+    }
+
+    for (const QUrl& resource : resources) {
+        setImageResource(resource, image);
+    }
+}
+
+void ChatWindow::setImageResource(const QUrl& resource, const QImage& image)
+{
+    QTextDocument* document = m_messageDisplay->document();
+    document->addResource(QTextDocument::ImageResource, resource, image);
+    // 尺寸变了，让文档重新排版
+    document->markContentsDirty(0, document->characterCount());
+}
+
+QString ChatWindow::imageKeyOf(const FeiqFileOffer& offer) const
+{
+    // 与MainWindow的键一致：包序号只在一个好友内唯一
+    return QStringLiteral("%1|%2|%3").arg(m_targetIp).arg(offer.packetNo).arg(offer.fileId);
 }
 
 void ChatWindow::closeEvent(QCloseEvent* event)
@@ -23,6 +23,7 @@
 #include <QSettings>
 #include <QDateTime>
 #include <QNetworkInterface>
+#include <QBrush>
 #include <algorithm>
 
 namespace
@@ -39,6 +40,15 @@ QString displayNameOf(const FeiqFellowInfo& fellow)
     return fellow.ip;
 }
 
+// 包序号只在一个好友内唯一，键带上对方ip
+QString imageKeyOf(const QString& ip, const FeiqFileOffer& offer)
+{
+    return QStringLiteral("%1|%2|%3").arg(ip).arg(offer.packetNo).arg(offer.fileId);
+}
+
+// 先于消息下载完的图片通常几毫秒内就等到消息，超过这个时间的不再等
+const qint64 kDownloadedImageTtlMs = 60 * 1000;
+
 }
 
 MainWindow::MainWindow(QWidget* parent)
@@ -101,6 +111,12 @@ MainWindow::MainWindow(QWidget* parent)
         m_backend->enableLoopbackTestUser();
         // 启用每10秒定期广播，确保无线网络下用户发现稳定
         m_backend->enableIntervalDetect(10);
+        if (!m_multicastGroup.isEmpty()) {
+            QString error;
+            if (!m_backend->enableMulticastDiscovery(m_multicastGroup, m_multicastTtl, &error)) {
+                qWarning() << "组播发现启用失败:" << error;
+            }
+        }
     }
 }
 
@@ -199,6 +215,8 @@ void MainWindow::loadSettings()
     m_username = settings.value("username", "CppUser").toString();
     m_hostname = settings.value("hostname", "").toString();
     m_groupname = settings.value("groupname", "我的好友").toString();
+    m_multicastGroup = settings.value("multicastGroup", "").toString();
+    m_multicastTtl = settings.value("multicastTtl", 8).toInt();
     
     if (m_hostname.isEmpty()) {
         m_hostname = QHostInfo::localHostName();
@@ -261,6 +279,15 @@ void MainWindow::handleMessageReceived(const FeiqMessage& message)
             appendTextToChat(ip, content.text, senderName, false);
             break;
         case FeiqContentType::File:
+            if (content.file.inlineImage) {
+                // 引擎已自动下载，可能在消息到达界面之前就下载完了
+                m_chatWindows[ip]->appendPendingImage(content.file, senderName);
+                const QString key = imageKeyOf(ip, content.file);
+                if (m_downloadedImages.contains(key)) {
+                    m_chatWindows[ip]->completePendingImage(m_downloadedImages.take(key).file);
+                }
+                break;
+            }
             appendFileOfferToChat(ip, content.file, senderName);
             promptFileDownload(ip, content.file, senderName);
             break;
@@ -288,6 +315,11 @@ void MainWindow::handleFileTaskUpdated(const FeiqFileTaskInfo& info)
         return;
     }
 
+    if (info.file.inlineImage) {
+        handleInlineImageTask(info);
+        return;
+    }
+
     QString actor = info.upload ? m_username : displayNameOf(info.fellow);
     bool isOwn = info.upload;
 
@@ -322,6 +354,41 @@ void MainWindow::handleFileTaskUpdated(const FeiqFileTaskInfo& info)
     }
 }
 
+void MainWindow::handleInlineImageTask(const FeiqFileTaskInfo& info)
+{
+    // 内嵌图片已在聊天中显示，只在出错时提示
+    const QString ip = info.fellow.ip;
+    switch (info.state) {
+    case FeiqFileTaskState::Finished:
+        if (!info.upload) {
+            ChatWindow* chatWindow = m_chatWindows.value(ip, nullptr);
+            if (!chatWindow || !chatWindow->completePendingImage(info.file)) {
+                const qint64 now = QDateTime::currentMSecsSinceEpoch();
+                for (auto it = m_downloadedImages.begin(); it != m_downloadedImages.end();) {
+                    if (now - it.value().finishedAt > kDownloadedImageTtlMs) {
+                        it = m_downloadedImages.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                m_downloadedImages.insert(imageKeyOf(ip, info.file), {ip, info.file, now});
+            }
+        }
+        break;
+    case FeiqFileTaskState::Error:
+        appendTextToChat(ip,
+                         info.upload ? tr("图片发送失败: %1").arg(info.file.fileName)
+                                     : tr("图片接收失败: %1").arg(info.detail),
+                         info.upload ? m_username : displayNameOf(info.fellow),
+                         info.upload);
+        break;
+    case FeiqFileTaskState::NotStart:
+    case FeiqFileTaskState::Running:
+    case FeiqFileTaskState::Canceled:
+        break;
+    }
+}
+
 void MainWindow::onUserItemDoubleClicked(QTreeWidgetItem* item, int column)
 {
     Q_UNUSED(column);
@@ -408,6 +475,15 @@ void MainWindow::onSendFileRequest(const QString& targetIp, const QString& fileP
     }
 }
 
+void MainWindow::onSendImageRequest(const QString& targetIp, const QString& imagePath)
+{
+    // 图片已在聊天窗口中显示，这里只负责发送
+    QString errorMessage;
+    if (!m_backend->sendImage(targetIp, imagePath, &errorMessage)) {
+        QMessageBox::critical(this, tr("错误"), errorMessage);
+    }
+}
+
 void MainWindow::updateUserList()
 {
     m_userTreeWidget->clear();
@@ -425,6 +501,10 @@ void MainWindow::updateUserList()
         const auto& fellow = m_users[ip];
         QTreeWidgetItem* userItem = new QTreeWidgetItem(groupItem);
         userItem->setText(0, QString("%1 (%2)").arg(displayNameOf(fellow), ip));
+        if (!fellow.verified) {
+            userItem->setForeground(0, QBrush(Qt::gray));
+            userItem->setToolTip(0, tr("上次在线，正在确认"));
+        }
         QMap<QString, QVariant> userData;
         userData["type"] = "user";
         userData["ip"] = ip;
@@ -622,14 +702,26 @@ void MainWindow::ensureChatWindowSignals(ChatWindow* chatWindow)
 {
     connect(chatWindow, &ChatWindow::sendFileRequest,
             this, &MainWindow::onSendFileRequest);
+    connect(chatWindow, &ChatWindow::sendImageRequest,
+            this, &MainWindow::onSendImageRequest);
 
     connect(chatWindow, &ChatWindow::destroyed, this, [this, chatWindow]() {
+        QString ip;
         for (auto it = m_chatWindows.begin(); it != m_chatWindows.end(); ++it) {
             if (it.value() == chatWindow) {
+                ip = it.key();
                 m_chatWindows.erase(it);
                 break;
             }
         }
+        // 窗口关了，这个好友还在等消息的图片也不再需要
+        for (auto it = m_downloadedImages.begin(); it != m_downloadedImages.end();) {
+            if (it.value().ip == ip) {
+                it = m_downloadedImages.erase(it);
+            } else {
+                ++it;
+            }
+        }
     });
 }
 
@@ -0,0 +1,107 @@
+#include "ui/ThumbnailCache.h"
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QRunnable>
+
+#include <functional>
+
+namespace
+{
+
+// 解码后的缩略图最多占用的内存（KB）
+const int kThumbnailCacheKb = 32 * 1024;
+// 解码线程数，图片多时也不与界面和网络线程抢太多CPU
+const int kDecodeThreads = 2;
+
+class DecodeJob : public QRunnable
+{
+public:
+    explicit DecodeJob(std::function<void()> job)
+        : m_job(std::move(job))
+    {
+    }
+
+    void run() override
+    {
+        m_job();
+    }
+
+private:
+    std::function<void()> m_job;
+};
+
+}
+
+ThumbnailCache* ThumbnailCache::instance()
+{
+    static ThumbnailCache* s_instance = new ThumbnailCache();
+    return s_instance;
+}
+
+ThumbnailCache::ThumbnailCache(QObject* parent)
+    : QObject(parent)
+    , m_cache(kThumbnailCacheKb)
+{
+    m_pool.setMaxThreadCount(kDecodeThreads);
+}
+
+QImage ThumbnailCache::request(const QString& path, const QSize& bound)
+{
+    const QString key = keyOf(path, bound);
+    if (QImage* cached = m_cache.object(key)) {
+        return *cached;
+    }
+
+    if (!m_pending.contains(key)) {
+        m_pending.insert(key);
+        m_pool.start(new DecodeJob([this, path, bound]() {
+            QImage image = decode(path, bound);
+            QMetaObject::invokeMethod(this, [this, path, bound, image]() {
+                finish(path, bound, image);
+            }, Qt::QueuedConnection);
+        }));
+    }
+    return QImage();
+}
+
+QString ThumbnailCache::keyOf(const QString& path, const QSize& bound)
+{
+    // 同一路径的文件被替换后，修改时间不同，不会取到旧的缩略图
+    const QFileInfo info(path);
+    return QStringLiteral("%1|%2|%3x%4")
+        .arg(info.absoluteFilePath())
+        .arg(info.lastModified().toMSecsSinceEpoch())
+        .arg(bound.width())
+        .arg(bound.height());
+}
+
+QImage ThumbnailCache::decode(const QString& path, const QSize& bound)
+{
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+
+    // 只读文件头拿到尺寸，让解码器直接输出缩小后的图，不先解出原图
+    const QSize original = reader.size();
+    if (original.isValid() && (original.width() > bound.width() || original.height() > bound.height())) {
+        reader.setScaledSize(original.scaled(bound, Qt::KeepAspectRatio));
+    }
+
+    QImage image = reader.read();
+    if (!image.isNull() && (image.width() > bound.width() || image.height() > bound.height())) {
+        image = image.scaled(bound, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    return image;
+}
+
+void ThumbnailCache::finish(const QString& path, const QSize& bound, const QImage& image)
+{
+    const QString key = keyOf(path, bound);
+    m_pending.remove(key);
+    if (!image.isNull()) {
+        const int costKb = qMax(1, static_cast<int>(image.sizeInBytes() / 1024));
+        m_cache.insert(key, new QImage(image), costKb);
+    }
+    emit thumbnailReady(path, bound, image);
+}
@@ -43,6 +43,7 @@ void VideoPlayerDialog::closeEvent(QCloseEvent* event)
 void VideoPlayerDialog::resizeEvent(QResizeEvent* event)
 {
     QDialog::resizeEvent(event);
+    updateReceiverDisplaySize();
     updateDisplayedPixmap();
 }
 
@@ -60,7 +61,7 @@ void VideoPlayerDialog::initializeUi()
     // 控制区域
     auto* controlLayout = new QHBoxLayout();
     m_startStopButton = new QPushButton(tr("开始接收"), this);
-    m_statsLabel = new QLabel(tr("FPS: -- | 丢帧: --"), this);
+    m_statsLabel = new QLabel(tr("FPS: -- | 丢帧: -- | 延迟: --"), this);
     
     controlLayout->addWidget(m_startStopButton);
     controlLayout->addStretch();
@@ -98,6 +99,7 @@ void VideoPlayerDialog::onStartStopClicked()
                     this, &VideoPlayerDialog::onReceiveError);
             connect(m_receiver, &VideoReceiver::statsUpdated,
                     this, &VideoPlayerDialog::onStatsUpdated);
+            updateReceiverDisplaySize();
         }
 
         if (!m_receiver->startListening()) {
@@ -148,15 +150,26 @@ void VideoPlayerDialog::onReceiveError(const QString& error)
     m_statusLabel->setStyleSheet("color: red;");
 }
 
-void VideoPlayerDialog::onStatsUpdated(int fps, int lostFrames)
+void VideoPlayerDialog::onStatsUpdated(int fps, int lostFrames, int latencyMs)
 {
-    m_statsLabel->setText(tr("FPS: %1 | 丢帧: %2").arg(fps).arg(lostFrames));
+    const QString latency = latencyMs >= 0 ? tr("%1 ms").arg(latencyMs) : QStringLiteral("--");
+    m_statsLabel->setText(tr("FPS: %1 | 丢帧: %2 | 延迟: %3").arg(fps).arg(lostFrames).arg(latency));
     
     if (!m_currentSender.isEmpty()) {
         m_statusLabel->setText(tr("接收来自 %1 的视频流").arg(m_currentSender));
     }
 }
 
+void VideoPlayerDialog::updateReceiverDisplaySize()
+{
+    if (!m_receiver || !m_videoLabel) {
+        return;
+    }
+
+    // 按显示区域的物理像素解码，不解出多余的分辨率
+    m_receiver->setDisplaySize(m_videoLabel->size() * m_videoLabel->devicePixelRatioF());
+}
+
 void VideoPlayerDialog::updateDisplayedPixmap()
 {
     if (m_currentPixmap.isNull() || !m_videoLabel) {
@@ -0,0 +1,123 @@
+#include "video/JpegDecoder.h"
+#include <QBuffer>
+#include <QByteArray>
+#include <QDebug>
+#include <QImageReader>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+namespace
+{
+
+// 取不小于显示所需的最小尺寸，缩放倍数由解码器在可用的分数中选
+QSize fittedSize(const QSize& original, const QSize& target)
+{
+    if (target.isEmpty() || (original.width() <= target.width() && original.height() <= target.height())) {
+        return original;
+    }
+    return original.scaled(target, Qt::KeepAspectRatio);
+}
+
+}
+
+JpegDecoder::JpegDecoder()
+{
+#ifdef HAVE_TURBOJPEG
+    m_handle = tjInitDecompress();
+    if (!m_handle) {
+        qDebug() << "[JpegDecoder] libjpeg-turbo初始化失败，改用QImageReader:" << tjGetErrorStr();
+    }
+#endif
+}
+
+JpegDecoder::~JpegDecoder()
+{
+#ifdef HAVE_TURBOJPEG
+    if (m_handle) {
+        tjDestroy(static_cast<tjhandle>(m_handle));
+    }
+#endif
+}
+
+QImage JpegDecoder::decode(const uint8_t* data, size_t size, const QSize& target)
+{
+#ifdef HAVE_TURBOJPEG
+    if (m_handle) {
+        tjhandle handle = static_cast<tjhandle>(m_handle);
+        unsigned char* jpeg = const_cast<unsigned char*>(data);
+        const unsigned long jpegSize = static_cast<unsigned long>(size);
+
+        int width = 0;
+        int height = 0;
+        int subsamp = 0;
+        int colorspace = 0;
+        if (tjDecompressHeader3(handle, jpeg, jpegSize, &width, &height, &subsamp, &colorspace) != 0) {
+            return QImage();
+        }
+
+        // 从最小的缩放倍数找起，第一个不小于显示所需尺寸的即可
+        const QSize needed = fittedSize(QSize(width, height), target);
+        int numFactors = 0;
+        const tjscalingfactor* factors = tjGetScalingFactors(&numFactors);
+        int scaledWidth = width;
+        int scaledHeight = height;
+        for (int i = 0; i < numFactors; ++i) {
+            const int w = TJSCALED(width, factors[i]);
+            const int h = TJSCALED(height, factors[i]);
+            if (w >= needed.width() && h >= needed.height() && w * h < scaledWidth * scaledHeight) {
+                scaledWidth = w;
+                scaledHeight = h;
+            }
+        }
+
+        // QImage::Format_RGB32按本机字节序存放0xffRRGGBB
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        const int pixelFormat = TJPF_BGRX;
+#else
+        const int pixelFormat = TJPF_XRGB;
+#endif
+        // 界面还持有上一帧时另开缓冲，否则原地复用
+        if (m_image.width() != scaledWidth || m_image.height() != scaledHeight || !m_image.isDetached()) {
+            m_image = QImage(scaledWidth, scaledHeight, QImage::Format_RGB32);
+            if (m_image.isNull()) {
+                return QImage();
+            }
+        }
+
+        if (tjDecompress2(handle, jpeg, jpegSize, m_image.bits(), scaledWidth,
+                          m_image.bytesPerLine(), scaledHeight, pixelFormat, TJFLAG_FASTDCT) != 0) {
+            // 数据被截断等可恢复的警告仍有可用的图像
+            if (tjGetErrorCode(handle) != TJERR_WARNING) {
+                return QImage();
+            }
+        }
+        return m_image;
+    }
+#endif
+
+    return decodeWithReader(data, size, target);
+}
+
+QImage JpegDecoder::decodeWithReader(const uint8_t* data, size_t size, const QSize& target)
+{
+    QByteArray ba = QByteArray::fromRawData(reinterpret_cast<const char*>(data), static_cast<int>(size));
+    QBuffer buffer(&ba);
+    buffer.open(QIODevice::ReadOnly);
+
+    // Qt的JPEG插件对setScaledSize同样先在DCT域缩小，再补足剩余的缩放
+    QImageReader reader(&buffer, "JPEG");
+    const QSize original = reader.size();
+    if (original.isValid()) {
+        const QSize needed = fittedSize(original, target);
+        if (needed != original) {
+            reader.setScaledSize(needed);
+        }
+    }
+
+    if (!reader.read(&m_image)) {
+        return QImage();
+    }
+    return m_image;
+}
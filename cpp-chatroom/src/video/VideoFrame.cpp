@@ -1,46 +1,176 @@
 #include "video/VideoFrame.h"
 #include "ipmsg.h"
+#include <algorithm>
 #include <cstring>
 
+size_t splitFrameToChunkViews(
+    const VideoFrameMeta& meta,
+    const uint8_t* data,
+    size_t size,
+    std::vector<VideoChunkView>& views,
+    size_t maxChunkSize,
+    int version)
+{
+    views.clear();
+
+    if (version != 1 && version != VIDEO_PROTOCOL_VERSION) {
+        return 0;
+    }
+    const size_t headerSize = version == 1 ? sizeof(VideoChunkHeader) : sizeof(VideoChunkHeaderV2);
+    if (size == 0 || size > UINT32_MAX || maxChunkSize <= headerSize) {
+        return 0;
+    }
+
+    const size_t maxPayload = maxChunkSize - headerSize;
+    const size_t totalChunks = (size + maxPayload - 1) / maxPayload;
+    if (totalChunks > UINT16_MAX) {
+        return 0;
+    }
+
+    // 帧元数据各分片相同，只有索引和载荷大小不同；v1只发出base部分
+    VideoChunkHeaderV2 header;
+    std::memset(&header, 0, sizeof(header));
+    header.base.magic = version == 1 ? VIDEO_FRAME_MAGIC : VIDEO_FRAME_MAGIC_V2;
+    header.base.frameId = meta.frameId;
+    header.base.totalChunks = static_cast<uint16_t>(totalChunks);
+    header.version = static_cast<uint8_t>(version);
+    header.codec = meta.codec;
+    header.headerSize = static_cast<uint16_t>(headerSize);
+    header.width = meta.width;
+    header.height = meta.height;
+    header.frameSize = static_cast<uint32_t>(size);
+    header.streamId = meta.streamId;
+    header.captureTimeMs = meta.timestamp;
+
+    views.resize(totalChunks);
+    size_t offset = 0;
+    for (size_t i = 0; i < totalChunks; ++i) {
+        const size_t remaining = size - offset;
+        const size_t payloadSize = (remaining > maxPayload) ? maxPayload : remaining;
+
+        VideoChunkView& view = views[i];
+        view.header = header;
+        view.header.base.chunkIndex = static_cast<uint16_t>(i);
+        view.header.base.payloadSize = static_cast<uint32_t>(payloadSize);
+        view.payload = data + offset;
+        view.payloadSize = payloadSize;
+
+        offset += payloadSize;
+    }
+
+    return totalChunks;
+}
+
+size_t appendParityChunks(
+    std::vector<VideoChunkView>& views,
+    size_t frameSize,
+    size_t groupSize,
+    std::vector<uint8_t>& parity)
+{
+    const size_t dataChunks = views.size();
+    if (groupSize == 0 || dataChunks == 0 || groupSize > UINT16_MAX) {
+        return 0;
+    }
+
+    const size_t groups = (dataChunks + groupSize - 1) / groupSize;
+    if (dataChunks + groups > UINT16_MAX) {
+        return 0;
+    }
+
+    // 除最后一个外所有数据分片等长，校验分片按此长度异或
+    const size_t stride = views[0].payloadSize;
+    const size_t parityPayload = sizeof(VideoParityHeader) + stride;
+    parity.assign(groups * parityPayload, 0);
+
+    views.reserve(dataChunks + groups);
+    for (size_t g = 0; g < groups; ++g) {
+        uint8_t* out = parity.data() + g * parityPayload;
+
+        VideoParityHeader parityHeader;
+        parityHeader.frameSize = static_cast<uint32_t>(frameSize);
+        parityHeader.groupSize = static_cast<uint16_t>(groupSize);
+        parityHeader.reserved = 0;
+        std::memcpy(out, &parityHeader, sizeof(parityHeader));
+
+        uint8_t* body = out + sizeof(VideoParityHeader);
+        const size_t end = std::min(dataChunks, (g + 1) * groupSize);
+        for (size_t i = g * groupSize; i < end; ++i) {
+            const uint8_t* payload = views[i].payload;
+            for (size_t b = 0; b < views[i].payloadSize; ++b) {
+                body[b] ^= payload[b];
+            }
+        }
+
+        VideoChunkView view;
+        view.header = views[0].header;
+        view.header.base.chunkIndex = static_cast<uint16_t>(dataChunks + g);
+        view.header.base.payloadSize = static_cast<uint32_t>(parityPayload);
+        view.payload = out;
+        view.payloadSize = parityPayload;
+        views.push_back(view);
+    }
+
+    return groups;
+}
+
+bool recoverChunkFromParity(
+    const uint8_t* parityPayload,
+    size_t paritySize,
+    const std::vector<std::pair<const uint8_t*, size_t>>& others,
+    size_t missingIndex,
+    size_t totalChunks,
+    std::vector<uint8_t>& out)
+{
+    if (paritySize <= sizeof(VideoParityHeader) || missingIndex >= totalChunks) {
+        return false;
+    }
+
+    VideoParityHeader parityHeader;
+    std::memcpy(&parityHeader, parityPayload, sizeof(parityHeader));
+
+    const size_t stride = paritySize - sizeof(VideoParityHeader);
+    size_t length = stride;
+    if (missingIndex == totalChunks - 1) {
+        // 最后一个分片的长度由整帧大小推出
+        const size_t before = missingIndex * stride;
+        if (parityHeader.frameSize <= before || parityHeader.frameSize - before > stride) {
+            return false;
+        }
+        length = parityHeader.frameSize - before;
+    }
+
+    out.assign(parityPayload + sizeof(VideoParityHeader), parityPayload + paritySize);
+    for (const auto& other : others) {
+        if (other.second > stride) {
+            return false;
+        }
+        for (size_t b = 0; b < other.second; ++b) {
+            out[b] ^= other.first[b];
+        }
+    }
+    out.resize(length);
+    return true;
+}
+
 std::vector<std::vector<uint8_t>> splitFrameToChunks(
     uint32_t frameId,
     const std::vector<uint8_t>& jpegData,
     size_t maxChunkSize)
 {
+    VideoFrameMeta meta;
+    meta.frameId = frameId;
+    std::vector<VideoChunkView> views;
+    splitFrameToChunkViews(meta, jpegData.data(), jpegData.size(), views, maxChunkSize, 1);
+
     std::vector<std::vector<uint8_t>> chunks;
-    
-    if (jpegData.empty()) {
-        return chunks;
-    }
-    
-    const size_t headerSize = sizeof(VideoChunkHeader);
-    const size_t maxPayload = maxChunkSize - headerSize;
-    const size_t totalSize = jpegData.size();
-    const uint16_t totalChunks = static_cast<uint16_t>((totalSize + maxPayload - 1) / maxPayload);
-    
-    size_t offset = 0;
-    for (uint16_t i = 0; i < totalChunks; ++i) {
-        size_t remaining = totalSize - offset;
-        size_t payloadSize = (remaining > maxPayload) ? maxPayload : remaining;
-        
-        // 创建包
-        std::vector<uint8_t> packet(headerSize + payloadSize);
-        
-        // 填充头
-        VideoChunkHeader* header = reinterpret_cast<VideoChunkHeader*>(packet.data());
-        header->magic = VIDEO_FRAME_MAGIC;
-        header->frameId = frameId;
-        header->chunkIndex = i;
-        header->totalChunks = totalChunks;
-        header->payloadSize = static_cast<uint32_t>(payloadSize);
-        
-        // 填充载荷
-        std::memcpy(packet.data() + headerSize, jpegData.data() + offset, payloadSize);
-        
+    chunks.reserve(views.size());
+    for (const auto& view : views) {
+        std::vector<uint8_t> packet(sizeof(VideoChunkHeader) + view.payloadSize);
+        std::memcpy(packet.data(), &view.header.base, sizeof(VideoChunkHeader));
+        std::memcpy(packet.data() + sizeof(VideoChunkHeader), view.payload, view.payloadSize);
         chunks.push_back(std::move(packet));
-        offset += payloadSize;
     }
-    
+
     return chunks;
 }
 
@@ -52,9 +182,97 @@ bool parseChunkHeader(const uint8_t* data, size_t size, VideoChunkHeader& header
     
     std::memcpy(&header, data, sizeof(VideoChunkHeader));
     
-    if (header.magic != VIDEO_FRAME_MAGIC) {
+    if (header.magic != VIDEO_FRAME_MAGIC && header.magic != VIDEO_FRAME_MAGIC_V2) {
         return false;
     }
     
     return true;
 }
+
+bool parseChunk(const uint8_t* data, size_t size, VideoChunkInfo& info)
+{
+    if (!parseChunkHeader(data, size, info.header)) {
+        return false;
+    }
+
+    info.meta = VideoFrameMeta();
+    info.meta.frameId = info.header.frameId;
+    if (info.header.magic == VIDEO_FRAME_MAGIC) {
+        info.version = 1;
+        info.headerSize = sizeof(VideoChunkHeader);
+        info.frameSize = 0;
+        return true;
+    }
+
+    if (size < sizeof(VideoChunkHeaderV2)) {
+        return false;
+    }
+    VideoChunkHeaderV2 header;
+    std::memcpy(&header, data, sizeof(VideoChunkHeaderV2));
+    // 更新的版本在末尾追加了字段，跳过即可
+    if (header.version < 2 || header.headerSize < sizeof(VideoChunkHeaderV2) || header.headerSize > size) {
+        return false;
+    }
+
+    info.version = header.version;
+    info.headerSize = header.headerSize;
+    info.frameSize = header.frameSize;
+    info.meta.width = header.width;
+    info.meta.height = header.height;
+    info.meta.timestamp = header.captureTimeMs;
+    info.meta.codec = header.codec;
+    info.meta.streamId = header.streamId;
+    return true;
+}
+
+size_t buildNackPacket(uint32_t frameId, const std::vector<uint16_t>& indexes,
+                       std::vector<uint8_t>& packet)
+{
+    const size_t maxCount = (VIDEO_MAX_CHUNK_SIZE - sizeof(VideoNackHeader)) / sizeof(uint16_t);
+    const size_t count = std::min(indexes.size(), maxCount);
+
+    VideoNackHeader header;
+    header.magic = VIDEO_NACK_MAGIC;
+    header.frameId = frameId;
+    header.count = static_cast<uint16_t>(count);
+    header.reserved = 0;
+
+    packet.resize(sizeof(VideoNackHeader) + count * sizeof(uint16_t));
+    std::memcpy(packet.data(), &header, sizeof(VideoNackHeader));
+    if (count > 0) {
+        std::memcpy(packet.data() + sizeof(VideoNackHeader), indexes.data(), count * sizeof(uint16_t));
+    }
+    return count;
+}
+
+bool parseNackPacket(const uint8_t* data, size_t size, uint32_t& frameId,
+                     std::vector<uint16_t>& indexes)
+{
+    if (size < sizeof(VideoNackHeader)) {
+        return false;
+    }
+
+    VideoNackHeader header;
+    std::memcpy(&header, data, sizeof(VideoNackHeader));
+    if (header.magic != VIDEO_NACK_MAGIC
+        || size < sizeof(VideoNackHeader) + header.count * sizeof(uint16_t)) {
+        return false;
+    }
+
+    frameId = header.frameId;
+    indexes.resize(header.count);
+    if (header.count > 0) {
+        std::memcpy(indexes.data(), data + sizeof(VideoNackHeader), header.count * sizeof(uint16_t));
+    }
+    return true;
+}
+
+bool parseReportPacket(const uint8_t* data, size_t size, VideoReportPacket& report)
+{
+    if (size < sizeof(VideoReportPacket)) {
+        return false;
+    }
+
+    std::memcpy(&report, data, sizeof(VideoReportPacket));
+    return report.magic == VIDEO_REPORT_MAGIC;
+}
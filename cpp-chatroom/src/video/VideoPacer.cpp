@@ -0,0 +1,232 @@
+#include "video/VideoPacer.h"
+#include <algorithm>
+
+namespace
+{
+
+// 令牌桶深度：空闲后最多连续发出的字节数，约8个满分片
+constexpr double kBurstBytes = 8 * 1400;
+// 一次交给发送函数的最大分片数
+constexpr size_t kMaxBatch = 64;
+// 等令牌时单次最长睡眠，保证停止和新的重传请求能及时处理
+constexpr qint64 kMaxSleepUs = 2000;
+// 无事可做时的等待时间，期间也会按时上报统计
+constexpr unsigned long kIdleWaitMs = 200;
+// 积压的未开始帧上限，超过时丢弃最旧的，排队延迟不超过约两帧
+constexpr size_t kMaxQueuedFrames = 2;
+// 保留复用的分片数组个数
+constexpr size_t kMaxSpare = 8;
+// 统计周期
+constexpr qint64 kStatsIntervalUs = 1000000;
+
+}
+
+VideoPacer::VideoPacer(SendFunction send, FrameDoneFunction frameDone, StatsFunction stats,
+                       QObject* parent)
+    : QThread(parent)
+    , m_send(std::move(send))
+    , m_frameDone(std::move(frameDone))
+    , m_stats(std::move(stats))
+{
+    m_clock.start();
+}
+
+VideoPacer::~VideoPacer()
+{
+    stop();
+}
+
+void VideoPacer::setTargetBitrate(qint64 bitsPerSecond)
+{
+    QMutexLocker locker(&m_mutex);
+    m_bitrate = std::max<qint64>(bitsPerSecond, 0);
+    m_wakeUp.wakeAll();
+}
+
+qint64 VideoPacer::targetBitrate() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_bitrate;
+}
+
+void VideoPacer::enqueueFrame(uint32_t frameId, std::vector<VideoChunkView>& chunks,
+                              Buffer data, Buffer parity)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_frames.size() >= kMaxQueuedFrames) {
+        recycle(m_frames.front());
+        m_frames.pop_front();
+        ++m_windowDropped;
+    }
+    enqueue(m_frames, frameId, false, chunks, std::move(data), std::move(parity));
+}
+
+void VideoPacer::enqueueRetransmit(uint32_t frameId, std::vector<VideoChunkView>& chunks, Buffer data)
+{
+    QMutexLocker locker(&m_mutex);
+    enqueue(m_retransmits, frameId, true, chunks, std::move(data), Buffer());
+}
+
+void VideoPacer::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wakeUp.wakeAll();
+    }
+    wait();
+
+    QMutexLocker locker(&m_mutex);
+    m_frames.clear();
+    m_retransmits.clear();
+}
+
+void VideoPacer::run()
+{
+    std::vector<VideoChunkView> batch;
+    batch.reserve(kMaxBatch);
+    Job current;
+    size_t next = 0;
+    int sent = 0;
+
+    QMutexLocker locker(&m_mutex);
+    // 与m_frameDone一样在锁外回调
+    const auto reportStats = [this, &locker]() {
+        qint64 bitsPerSecond = 0;
+        int dropped = 0;
+        if (takeStats(bitsPerSecond, dropped)) {
+            locker.unlock();
+            m_stats(bitsPerSecond, dropped);
+            locker.relock();
+        }
+    };
+
+    m_lastRefillUs = m_clock.nsecsElapsed() / 1000;
+    m_windowStartUs = m_lastRefillUs;
+    m_tokens = kBurstBytes;
+
+    while (!m_stopping) {
+        if (next >= current.chunks.size()) {
+            if (!current.chunks.empty()) {
+                const uint32_t frameId = current.frameId;
+                const bool retransmit = current.retransmit;
+                const int total = static_cast<int>(current.chunks.size());
+                recycle(current);
+                if (!retransmit) {
+                    locker.unlock();
+                    m_frameDone(frameId, sent, total);
+                    locker.relock();
+                }
+            }
+            next = 0;
+            sent = 0;
+
+            std::deque<Job>& queue = !m_retransmits.empty() ? m_retransmits : m_frames;
+            if (queue.empty()) {
+                reportStats();
+                m_wakeUp.wait(&m_mutex, kIdleWaitMs);
+                continue;
+            }
+            current = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        refillTokens();
+
+        // 令牌够多少就一次交出多少，限速只在批与批之间
+        batch.clear();
+        double bytes = 0;
+        while (next + batch.size() < current.chunks.size() && batch.size() < kMaxBatch) {
+            const VideoChunkView& view = current.chunks[next + batch.size()];
+            const double size = static_cast<double>(view.header.headerSize + view.payloadSize);
+            if (m_bitrate > 0 && bytes + size > m_tokens) {
+                break;
+            }
+            batch.push_back(view);
+            bytes += size;
+        }
+
+        if (batch.empty()) {
+            const VideoChunkView& view = current.chunks[next];
+            const double needed = static_cast<double>(view.header.headerSize + view.payloadSize) - m_tokens;
+            const qint64 waitUs = static_cast<qint64>(needed * 8e6 / static_cast<double>(m_bitrate)) + 1;
+            locker.unlock();
+            QThread::usleep(static_cast<unsigned long>(std::min(waitUs, kMaxSleepUs)));
+            locker.relock();
+            continue;
+        }
+
+        next += batch.size();
+        if (m_bitrate > 0) {
+            m_tokens -= bytes;
+        }
+
+        locker.unlock();
+        const int ok = m_send(batch);
+        locker.relock();
+
+        sent += ok;
+        m_windowBytes += static_cast<qint64>(bytes);
+        reportStats();
+    }
+
+    if (!current.chunks.empty()) {
+        recycle(current);
+    }
+}
+
+void VideoPacer::enqueue(std::deque<Job>& queue, uint32_t frameId, bool retransmit,
+                         std::vector<VideoChunkView>& chunks, Buffer data, Buffer parity)
+{
+    Job job;
+    job.frameId = frameId;
+    job.retransmit = retransmit;
+    job.chunks.swap(chunks);
+    job.data = std::move(data);
+    job.parity = std::move(parity);
+    queue.push_back(std::move(job));
+
+    if (!m_spare.empty()) {
+        chunks.swap(m_spare.back());
+        m_spare.pop_back();
+    }
+    chunks.clear();
+    m_wakeUp.wakeAll();
+}
+
+void VideoPacer::recycle(Job& job)
+{
+    job.chunks.clear();
+    if (m_spare.size() < kMaxSpare) {
+        m_spare.push_back(std::move(job.chunks));
+    }
+    job.chunks = std::vector<VideoChunkView>();
+    job.data.reset();
+    job.parity.reset();
+}
+
+void VideoPacer::refillTokens()
+{
+    const qint64 now = m_clock.nsecsElapsed() / 1000;
+    if (m_bitrate > 0) {
+        m_tokens = std::min(kBurstBytes,
+                            m_tokens + static_cast<double>(now - m_lastRefillUs) * static_cast<double>(m_bitrate) / 8e6);
+    }
+    m_lastRefillUs = now;
+}
+
+bool VideoPacer::takeStats(qint64& bitsPerSecond, int& framesDropped)
+{
+    const qint64 now = m_clock.nsecsElapsed() / 1000;
+    const qint64 elapsed = now - m_windowStartUs;
+    if (elapsed < kStatsIntervalUs) {
+        return false;
+    }
+
+    bitsPerSecond = m_windowBytes * 8 * 1000000 / elapsed;
+    framesDropped = m_windowDropped;
+    m_windowBytes = 0;
+    m_windowDropped = 0;
+    m_windowStartUs = now;
+    return true;
+}
@@ -1,15 +1,113 @@
 #include "video/VideoReceiver.h"
 #include "video/VideoFrame.h"
+#include "video/JpegDecoder.h"
 #include "ipmsg.h"
 #include <QDebug>
 #include <QDateTime>
-#include <QBuffer>
-#include <QImageReader>
+#include <QMetaObject>
+#include <QRunnable>
+#include <QThread>
+#include <QTimer>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <cerrno>
+#endif
+
+namespace
+{
+
+// 检查重传和超时的间隔，需远小于帧重组时限
+constexpr int kCheckIntervalMs = 10;
+// 帧在这段时间内没有新分片到达，才认为缺的分片已经丢了
+constexpr qint64 kNackQuietMs = 10;
+// 同一帧两次重传请求的最小间隔，约为局域网一个往返加发送的时间
+constexpr qint64 kNackIntervalMs = 20;
+// 每帧最多请求的轮数
+constexpr int kMaxNackRounds = 3;
+// 每个槽位预分配的帧数据大小，常见的JPEG帧不会触发扩容
+constexpr size_t kSlotReserveBytes = 128 * 1024;
+// 单帧数据的上限，分片数和整帧大小都来自网络，超出的帧不予重组
+constexpr size_t kMaxFrameSize = 4 * 1024 * 1024;
+// 接收缓冲，解码或调度卡顿时由内核先缓存突发的分片
+constexpr int kReceiveBufferSize = 4 * 1024 * 1024;
+// recvmmsg每批接收的包数和单包缓冲大小
+constexpr size_t kRecvBatch = 32;
+constexpr size_t kRecvPacketSize = 2048;
+// 解码线程数，一个解码时另一个可以处理下一帧
+constexpr int kDecodeThreads = 2;
+// 播放缓冲延迟的上限（毫秒），没有抖动时为0
+constexpr qint64 kMaxPlayoutDelayMs = 100;
+// 抖动均值和偏差的平滑系数，与RTP的到达抖动估计相同取1/16
+constexpr double kJitterGain = 1.0 / 16;
+// 缓冲延迟取均值加几倍平均偏差，偶尔更晚的帧靠丢弃兜底
+constexpr double kJitterDeviations = 3.0;
+// 超过播放时刻这么久的帧不再解码和显示
+constexpr qint64 kMaxLateMs = 100;
+// 抖动缓冲最多存放的帧数，30fps下最大缓冲延迟约为三帧
+constexpr size_t kMaxBufferedFrames = 4;
+// 时钟偏移取这段时间内的最小值，到期重新统计，跟上两端时钟的漂移
+constexpr qint64 kClockWindowMs = 10000;
+// v1没有推流会话号：帧ID比见过的最新帧回退超过这么多，或这么久没有分片，当作推流端已重新开始
+constexpr int32_t kRestartFrameGap = 32;
+constexpr qint64 kStreamIdleMs = 1000;
+
+class DecodeJob : public QRunnable
+{
+public:
+    explicit DecodeJob(std::function<void()> job)
+        : m_job(std::move(job))
+    {
+    }
+
+    void run() override
+    {
+        m_job();
+    }
+
+private:
+    std::function<void()> m_job;
+};
+
+class ReceiveThread : public QThread
+{
+public:
+    explicit ReceiveThread(std::function<void()> body)
+        : m_body(std::move(body))
+    {
+    }
+
+protected:
+    void run() override
+    {
+        m_body();
+    }
+
+private:
+    std::function<void()> m_body;
+};
+
+}
 
 VideoReceiver::VideoReceiver(QObject* parent)
     : QObject(parent)
 {
+    for (FrameSlot& slot : m_slots) {
+        slot.data.resize(kSlotReserveBytes);
+        slot.tail.reserve(VIDEO_MAX_CHUNK_SIZE);
+    }
+    m_decodePool.setMaxThreadCount(kDecodeThreads);
+
+    m_playoutTimer = new QTimer(this);
+    m_playoutTimer->setSingleShot(true);
+    m_playoutTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_playoutTimer, &QTimer::timeout, this, &VideoReceiver::playDueFrames);
 }
 
 VideoReceiver::~VideoReceiver()
@@ -19,33 +117,44 @@ VideoReceiver::~VideoReceiver()
 
 bool VideoReceiver::startListening(uint16_t port)
 {
-    QMutexLocker locker(&m_mutex);
-
     if (m_listening) {
         return true;
     }
 
-    if (!m_socket) {
-        m_socket = new QUdpSocket(this);
-    }
-
-    if (!m_socket->bind(QHostAddress::Any, port)) {
-        qDebug() << "[VideoReceiver] 绑定端口失败:" << m_socket->errorString();
-        emit receiveError("绑定端口失败: " + m_socket->errorString());
+    m_lastStatsTime = QDateTime::currentMSecsSinceEpoch();
+    m_framesReceived = 0;
+    m_framesLost = 0;
+    m_chunksRecovered = 0;
+    m_chunksRequested = 0;
+    m_framesSkipped = 0;
+    m_framesLate = 0;
+    m_streamerPort = 0;
+    m_streamId = 0;
+    m_hasNewestFrame = false;
+    m_hasPlayed = false;
+    m_hasClockOffset = false;
+    m_readyDelayMean = 0;
+    m_readyDelayDeviation = 0;
+    m_playoutDelayMs = 0;
+    m_latencySum = 0;
+    m_latencyCount = 0;
+    m_stopping = false;
+
+    // 套接字在接收线程中创建和使用，这里等它绑定完成
+    m_receiveThread = new ReceiveThread([this, port]() { receiveLoop(port); });
+    m_receiveThread->start();
+    m_bindDone.acquire();
+
+    if (!m_bindOk) {
+        m_receiveThread->wait();
+        delete m_receiveThread;
+        m_receiveThread = nullptr;
+        qDebug() << "[VideoReceiver] 绑定端口失败:" << m_bindError;
+        emit receiveError("绑定端口失败: " + m_bindError);
         return false;
     }
 
-    connect(m_socket, &QUdpSocket::readyRead, this, &VideoReceiver::onReadyRead);
-
-    // 超时检查定时器
-    m_timeoutTimer = new QTimer(this);
-    connect(m_timeoutTimer, &QTimer::timeout, this, &VideoReceiver::onTimeoutCheck);
-    m_timeoutTimer->start(50); // 50ms检查一次
-
     m_listening = true;
-    m_lastStatsTime = QDateTime::currentMSecsSinceEpoch();
-    m_framesReceived = 0;
-    m_framesLost = 0;
 
     qDebug() << "[VideoReceiver] 开始监听端口" << port;
     emit listeningStarted(port);
@@ -55,175 +164,687 @@ bool VideoReceiver::startListening(uint16_t port)
 
 void VideoReceiver::stopListening()
 {
-    QMutexLocker locker(&m_mutex);
-
     if (!m_listening) {
         return;
     }
 
     m_listening = false;
 
-    if (m_timeoutTimer) {
-        m_timeoutTimer->stop();
-        delete m_timeoutTimer;
-        m_timeoutTimer = nullptr;
+    // 先停接收线程，再等解码完成，之后槽位不再有人使用
+    m_stopping = true;
+    if (m_receiveThread) {
+        m_receiveThread->wait();
+        delete m_receiveThread;
+        m_receiveThread = nullptr;
     }
+    m_decodePool.waitForDone();
 
-    if (m_socket) {
-        m_socket->close();
-        delete m_socket;
-        m_socket = nullptr;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (FrameSlot& slot : m_slots) {
+            slot.state = FrameSlot::State::Free;
+        }
+        m_jitterBuffer.clear();
     }
-
-    m_frameBuffers.clear();
+    m_playoutTimer->stop();
 
     qDebug() << "[VideoReceiver] 停止监听";
     emit listeningStopped();
 }
 
-void VideoReceiver::onReadyRead()
+void VideoReceiver::setDisplaySize(const QSize& size)
 {
-    while (m_socket && m_socket->hasPendingDatagrams()) {
-        QByteArray datagram;
-        datagram.resize(static_cast<int>(m_socket->pendingDatagramSize()));
+    QMutexLocker locker(&m_mutex);
+    m_displaySize = size;
+}
+
+void VideoReceiver::receiveLoop(uint16_t port)
+{
+    QUdpSocket socket;
+    m_bindOk = socket.bind(QHostAddress::Any, port);
+    if (!m_bindOk) {
+        m_bindError = socket.errorString();
+        m_bindDone.release();
+        return;
+    }
+    socket.setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, kReceiveBufferSize);
+    m_socket = &socket;
+    m_bindDone.release();
+
+    qint64 nextCheck = 0;
+    while (!m_stopping) {
+        receivePending(socket);
+
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        if (now >= nextCheck) {
+            checkTimeouts(now);
+            nextCheck = now + kCheckIntervalMs;
+        }
+    }
+
+    m_socket = nullptr;
+}
+
+void VideoReceiver::receivePending(QUdpSocket& socket)
+{
+#ifdef Q_OS_LINUX
+    const int fd = static_cast<int>(socket.socketDescriptor());
+    pollfd pfd{fd, POLLIN, 0};
+    if (::poll(&pfd, 1, kCheckIntervalMs) <= 0) {
+        return;
+    }
+
+    m_recvBuffers.resize(kRecvBatch * kRecvPacketSize);
+    mmsghdr msgs[kRecvBatch];
+    iovec iovs[kRecvBatch];
+    sockaddr_storage addrs[kRecvBatch];
+
+    // 一次系统调用取走多个包，直到读空
+    for (;;) {
+        for (size_t i = 0; i < kRecvBatch; ++i) {
+            iovs[i].iov_base = m_recvBuffers.data() + i * kRecvPacketSize;
+            iovs[i].iov_len = kRecvPacketSize;
+            std::memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int count = ::recvmmsg(fd, msgs, static_cast<unsigned int>(kRecvBatch), MSG_DONTWAIT, nullptr);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const sockaddr* addr = reinterpret_cast<const sockaddr*>(&addrs[i]);
+            quint16 senderPort = 0;
+            if (addr->sa_family == AF_INET) {
+                senderPort = ntohs(reinterpret_cast<const sockaddr_in*>(addr)->sin_port);
+            } else if (addr->sa_family == AF_INET6) {
+                senderPort = ntohs(reinterpret_cast<const sockaddr_in6*>(addr)->sin6_port);
+            }
+            processChunk(QHostAddress(addr), senderPort,
+                         static_cast<const uint8_t*>(iovs[i].iov_base), msgs[i].msg_len);
+        }
+
+        if (static_cast<size_t>(count) < kRecvBatch) {
+            return;
+        }
+    }
+#else
+    if (!socket.waitForReadyRead(kCheckIntervalMs)) {
+        return;
+    }
+
+    while (socket.hasPendingDatagrams()) {
+        m_datagram.resize(static_cast<int>(qMax<qint64>(socket.pendingDatagramSize(), 0)));
         QHostAddress sender;
         quint16 senderPort;
 
-        m_socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
-        processChunk(sender, datagram);
+        const qint64 size = socket.readDatagram(m_datagram.data(), m_datagram.size(), &sender, &senderPort);
+        if (size > 0) {
+            processChunk(sender, senderPort, reinterpret_cast<const uint8_t*>(m_datagram.constData()),
+                         static_cast<size_t>(size));
+        }
     }
+#endif
 }
 
-void VideoReceiver::processChunk(const QHostAddress& sender, const QByteArray& data)
+void VideoReceiver::processChunk(const QHostAddress& sender, quint16 senderPort, const uint8_t* data, size_t size)
 {
-    if (data.size() < static_cast<int>(sizeof(VideoChunkHeader))) {
+    VideoChunkInfo info;
+    if (!parseChunk(data, size, info)) {
         return;
     }
-
-    VideoChunkHeader header;
-    if (!parseChunkHeader(reinterpret_cast<const uint8_t*>(data.constData()),
-                          static_cast<size_t>(data.size()), header)) {
+    const VideoChunkHeader& header = info.header;
+    // 目前只能解码JPEG，其他编码的帧直接忽略
+    if (header.totalChunks == 0 || info.meta.codec != VIDEO_CODEC_JPEG) {
         return;
     }
 
     QMutexLocker locker(&m_mutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
 
-    // 获取或创建帧缓冲
-    auto& buffer = m_frameBuffers[header.frameId];
-    if (buffer.frameId == 0) {
-        buffer.frameId = header.frameId;
-        buffer.totalChunks = header.totalChunks;
-        buffer.chunks.resize(header.totalChunks);
-        buffer.received.resize(header.totalChunks, false);
-        buffer.firstChunkTime = QDateTime::currentMSecsSinceEpoch();
-        buffer.senderIp = sender.toString();
+    // 推流端重新开始推流，帧ID从0重新计数，旧会话的帧号不能再用来比较新旧
+    if (info.meta.streamId != m_streamId
+        || (info.meta.streamId == 0 && isStreamRestart(header.frameId, now))) {
+        resetStream(info.meta.streamId);
     }
+    if (!m_hasNewestFrame || static_cast<int32_t>(header.frameId - m_newestFrameId) > 0) {
+        m_newestFrameId = header.frameId;
+        m_hasNewestFrame = true;
+    }
+    m_lastChunkTime = now;
 
-    // 存储分片
-    if (header.chunkIndex < buffer.totalChunks && !buffer.received[header.chunkIndex]) {
-        const uint8_t* payload = reinterpret_cast<const uint8_t*>(data.constData()) + sizeof(VideoChunkHeader);
-        size_t payloadSize = static_cast<size_t>(data.size()) - sizeof(VideoChunkHeader);
-        
-        buffer.chunks[header.chunkIndex].assign(payload, payload + payloadSize);
-        buffer.received[header.chunkIndex] = true;
+    // 比最新帧早出一整圈槽位的帧早已过了重组时限，槽位释放后也不再重组
+    if (static_cast<int32_t>(header.frameId - m_newestFrameId) <= -static_cast<int32_t>(kFrameSlots)) {
+        return;
+    }
 
-        // 检查是否完整
-        if (buffer.isComplete()) {
-            locker.unlock();
-            completeFrame(header.frameId);
+    FrameSlot& slot = m_slots[header.frameId % kFrameSlots];
+    if (slot.state != FrameSlot::State::Free && slot.frameId == header.frameId
+        && slot.session == m_session) {
+        // 已完成或已超时的帧：校验分片在数据分片之后发出，帧收齐后仍会陆续到达
+        if (slot.state != FrameSlot::State::Assembling || slot.totalChunks != header.totalChunks) {
+            return;
+        }
+    } else {
+        if (slot.state == FrameSlot::State::Decoding) {
+            return;     // 槽位中的帧还在解码，数据不能覆盖
+        }
+        if (slot.state != FrameSlot::State::Free
+            && static_cast<int32_t>(header.frameId - slot.frameId) < 0) {
+            return;     // 更旧的帧，槽位已经让给新帧
         }
+        if (slot.state == FrameSlot::State::Assembling) {
+            ++m_framesLost;     // 被新帧挤出还没收齐
+        }
+        slot.reset(header.frameId, header.totalChunks, info.frameSize);
+        slot.streamId = info.meta.streamId;
+        slot.session = m_session;
+        slot.timestamp = info.version >= 2 ? info.meta.timestamp : static_cast<uint64_t>(now);
+        slot.firstChunkTime = now;
+        slot.senderIp = sender.toString();
+        slot.senderAddress = sender;
+        slot.senderPort = senderPort;
+    }
+    slot.lastChunkTime = now;
+    m_streamerAddress = sender;
+    m_streamerPort = senderPort;
+
+    const uint8_t* payload = data + info.headerSize;
+    const size_t payloadSize = size - info.headerSize;
+
+    // 校验分片：组内只缺一个数据分片时可以直接恢复
+    bool recovered = false;
+    if (header.chunkIndex >= slot.totalChunks) {
+        const uint16_t group = static_cast<uint16_t>(header.chunkIndex - slot.totalChunks);
+        slot.storeParity(group, payload, payloadSize);
+        recovered = slot.tryRecover(group, m_recovered);
+    } else if (!slot.has(header.chunkIndex)) {
+        if (!slot.store(header.chunkIndex, payload, payloadSize)) {
+            return;
+        }
+        if (slot.groupSize > 0) {
+            recovered = slot.tryRecover(static_cast<uint16_t>(header.chunkIndex / slot.groupSize), m_recovered);
+        }
+    } else {
+        return;
+    }
+
+    if (recovered) {
+        ++m_chunksRecovered;
+    }
+
+    if (slot.isComplete()) {
+        slot.finish();
+        slot.state = FrameSlot::State::Decoding;
+        m_lastCompletedFrame = slot.frameId;
+        ++m_framesReceived;
+
+        const size_t index = static_cast<size_t>(&slot - m_slots.data());
+        const uint32_t frameId = slot.frameId;
+        locker.unlock();
+
+        m_decodePool.start(new DecodeJob([this, index, frameId]() { decodeFrame(index, frameId); }));
     }
 }
 
-void VideoReceiver::completeFrame(uint32_t frameId)
+bool VideoReceiver::isStreamRestart(uint32_t frameId, qint64 now) const
 {
+    if (!m_hasNewestFrame) {
+        return false;
+    }
+    return static_cast<int32_t>(frameId - m_newestFrameId) < -kRestartFrameGap
+        || now - m_lastChunkTime > kStreamIdleMs;
+}
+
+void VideoReceiver::resetStream(uint32_t streamId)
+{
+    qDebug() << "[VideoReceiver] 推流会话变更:" << m_streamId << "->" << streamId;
+    m_streamId = streamId;
+    ++m_session;
+
+    // 正在解码的槽位解完后按m_session丢弃，其余直接释放
+    for (FrameSlot& slot : m_slots) {
+        if (slot.state != FrameSlot::State::Decoding) {
+            slot.state = FrameSlot::State::Free;
+        }
+    }
+    m_jitterBuffer.clear();
+    m_hasPlayed = false;
+    m_hasNewestFrame = false;
+    m_hasClockOffset = false;
+    m_readyDelayMean = 0;
+    m_readyDelayDeviation = 0;
+    m_playoutDelayMs = 0;
+}
+
+void VideoReceiver::decodeFrame(size_t index, uint32_t frameId)
+{
+    // 解码器不是线程安全的，每个解码线程一个，线程间不共享
+    thread_local JpegDecoder decoder;
+
+    FrameSlot& slot = m_slots[index];
+    QSize displaySize;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (slot.state != FrameSlot::State::Decoding || slot.frameId != frameId) {
+            return;
+        }
+        // 解码跟不上时，已经赶不上播放的帧不再解码
+        if (isTooLate(frameId, slot.timestamp, QDateTime::currentMSecsSinceEpoch())) {
+            slot.state = FrameSlot::State::Closed;
+            ++m_framesSkipped;
+            return;
+        }
+        displaySize = m_displaySize;
+    }
+
+    // 槽位处于Decoding状态时接收线程不会改写它，直接从槽位的数据解码，不复制
+    const QImage image = decoder.decode(slot.frameData(), slot.frameSize, displaySize);
+
     QMutexLocker locker(&m_mutex);
+    slot.state = FrameSlot::State::Closed;
+    if (image.isNull() || slot.session != m_session) {
+        return;
+    }
+
+    VideoFrameMeta meta;
+    meta.frameId = frameId;
+    meta.width = static_cast<uint16_t>(image.width());
+    meta.height = static_cast<uint16_t>(image.height());
+    meta.timestamp = slot.timestamp;
+    meta.streamId = slot.streamId;
+    enqueuePlayout(meta, image, slot.senderIp, QDateTime::currentMSecsSinceEpoch());
+}
+
+bool VideoReceiver::isTooLate(uint32_t frameId, uint64_t timestamp, qint64 now) const
+{
+    // 不往回播：不比已显示的帧新的一律丢弃
+    if (m_hasPlayed && static_cast<int32_t>(frameId - m_lastPlayedFrame) <= 0) {
+        return true;
+    }
+    if (!m_hasClockOffset) {
+        return false;
+    }
+    const qint64 playoutTime = static_cast<qint64>(timestamp) + m_clockOffset + m_playoutDelayMs;
+    return now - playoutTime > kMaxLateMs;
+}
+
+void VideoReceiver::enqueuePlayout(const VideoFrameMeta& meta, const QImage& image, const QString& senderIp, qint64 now)
+{
+    const qint64 timestamp = static_cast<qint64>(meta.timestamp);
+    updateClockOffset(now - timestamp, now);
+
+    // 以最快的一帧为基准，比它晚多少就是这一帧经历的抖动
+    const qint64 baseTime = timestamp + m_clockOffset;
+    updatePlayoutDelay(now - baseTime);
 
-    auto it = m_frameBuffers.find(frameId);
-    if (it == m_frameBuffers.end()) {
+    if (isTooLate(meta.frameId, meta.timestamp, now)) {
+        ++m_framesLate;
         return;
     }
 
-    auto& buffer = it->second;
-    std::vector<uint8_t> jpegData = buffer.assemble();
-    QString senderIp = buffer.senderIp;
+    // 并行解码或等重传时帧可能乱序完成，按帧ID插入
+    auto position = std::find_if(m_jitterBuffer.begin(), m_jitterBuffer.end(), [&](const BufferedFrame& frame) {
+        return static_cast<int32_t>(frame.meta.frameId - meta.frameId) > 0;
+    });
+    BufferedFrame frame;
+    frame.meta = meta;
+    frame.image = image;
+    frame.senderIp = senderIp;
+    frame.baseTime = baseTime;
+    m_jitterBuffer.insert(position, std::move(frame));
+
+    while (m_jitterBuffer.size() > kMaxBufferedFrames) {
+        m_jitterBuffer.pop_front();
+        ++m_framesLate;
+    }
+
+    // 事件队列里最多只有一次重新定时
+    if (!m_playoutQueued) {
+        m_playoutQueued = true;
+        QMetaObject::invokeMethod(this, [this]() { schedulePlayout(); }, Qt::QueuedConnection);
+    }
+}
+
+void VideoReceiver::updateClockOffset(qint64 offset, qint64 now)
+{
+    if (!m_hasClockOffset) {
+        m_hasClockOffset = true;
+        m_clockOffset = offset;
+        m_windowClockOffset = offset;
+        m_clockWindowStart = now;
+        return;
+    }
 
-    // 解码JPEG
-    QByteArray ba(reinterpret_cast<const char*>(jpegData.data()), 
-                  static_cast<int>(jpegData.size()));
-    QBuffer qbuffer(&ba);
-    qbuffer.open(QIODevice::ReadOnly);
-    
-    QImageReader reader(&qbuffer, "JPEG");
-    QImage image = reader.read();
+    // 变小立即采用；窗口到期时换成窗口内的最小值，偏移变大（时钟漂移）也能跟上
+    m_clockOffset = std::min(m_clockOffset, offset);
+    m_windowClockOffset = std::min(m_windowClockOffset, offset);
+    if (now - m_clockWindowStart >= kClockWindowMs) {
+        m_clockOffset = m_windowClockOffset;
+        m_windowClockOffset = offset;
+        m_clockWindowStart = now;
+    }
+}
 
-    // 清理此帧
-    m_frameBuffers.erase(it);
-    m_lastCompletedFrame = frameId;
-    ++m_framesReceived;
+void VideoReceiver::updatePlayoutDelay(qint64 readyDelay)
+{
+    const double sample = static_cast<double>(std::max<qint64>(readyDelay, 0));
+    m_readyDelayMean += (sample - m_readyDelayMean) * kJitterGain;
+    m_readyDelayDeviation += (std::abs(sample - m_readyDelayMean) - m_readyDelayDeviation) * kJitterGain;
 
+    const double delay = m_readyDelayMean + kJitterDeviations * m_readyDelayDeviation;
+    m_playoutDelayMs = std::min(static_cast<qint64>(std::lround(delay)), kMaxPlayoutDelayMs);
+}
+
+void VideoReceiver::schedulePlayout()
+{
+    QMutexLocker locker(&m_mutex);
+    m_playoutQueued = false;
+    if (m_jitterBuffer.empty()) {
+        return;
+    }
+
+    const qint64 playoutTime = m_jitterBuffer.front().baseTime + m_playoutDelayMs;
+    const qint64 wait = std::max<qint64>(playoutTime - QDateTime::currentMSecsSinceEpoch(), 0);
     locker.unlock();
 
-    if (!image.isNull()) {
-        emit frameReceived(image, frameId, senderIp);
+    m_playoutTimer->start(static_cast<int>(wait));
+}
+
+void VideoReceiver::playDueFrames()
+{
+    QMutexLocker locker(&m_mutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    // 取到期的最新一帧，比它旧的到期帧已经错过播放时刻
+    auto due = m_jitterBuffer.end();
+    for (auto it = m_jitterBuffer.begin();
+         it != m_jitterBuffer.end() && it->baseTime + m_playoutDelayMs <= now; ++it) {
+        due = it;
+    }
+    if (due == m_jitterBuffer.end()) {
+        locker.unlock();
+        schedulePlayout();
+        return;
+    }
+
+    m_framesLate += static_cast<int>(due - m_jitterBuffer.begin());
+    const BufferedFrame frame = std::move(*due);
+    m_jitterBuffer.erase(m_jitterBuffer.begin(), due + 1);
+    m_lastPlayedFrame = frame.meta.frameId;
+    m_hasPlayed = true;
+
+    // v2帧为采集到显示的延迟，需两端时钟同步（如NTP）；时钟不同步算出负值的不计
+    const qint64 latency = now - static_cast<qint64>(frame.meta.timestamp);
+    if (latency >= 0) {
+        m_latencySum += latency;
+        ++m_latencyCount;
     }
+    locker.unlock();
+
+    emit frameReceived(frame.image, frame.meta.frameId, frame.senderIp);
+    schedulePlayout();
 }
 
-void VideoReceiver::onTimeoutCheck()
+void VideoReceiver::checkTimeouts(qint64 now)
 {
     QMutexLocker locker(&m_mutex);
 
-    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    requestMissingChunks(now);
 
-    // 清理超时帧
-    std::vector<uint32_t> toRemove;
-    for (auto& [frameId, buffer] : m_frameBuffers) {
-        if (now - buffer.firstChunkTime > VIDEO_FRAME_TIMEOUT_MS) {
-            toRemove.push_back(frameId);
+    // 关闭超时帧；已关闭的帧过了重组时限不会再有分片，释放槽位，免得挡住帧号更小的帧
+    for (FrameSlot& slot : m_slots) {
+        if (slot.state == FrameSlot::State::Assembling
+            && now - slot.firstChunkTime > VIDEO_FRAME_TIMEOUT_MS) {
+            slot.state = FrameSlot::State::Closed;
             ++m_framesLost;
+        } else if (slot.state == FrameSlot::State::Closed
+                   && now - slot.lastChunkTime > VIDEO_FRAME_TIMEOUT_MS) {
+            slot.state = FrameSlot::State::Free;
         }
     }
 
-    for (uint32_t id : toRemove) {
-        m_frameBuffers.erase(id);
-    }
-
     // 每秒更新统计
     if (now - m_lastStatsTime >= 1000) {
-        int fps = m_framesReceived;
+        const int fps = m_framesReceived;
+        const int lost = m_framesLost;
+        const int recovered = m_chunksRecovered;
+        const int requested = m_chunksRequested;
+        const int skipped = m_framesSkipped;
+        const int late = m_framesLate;
+        const int latency = m_latencyCount > 0 ? static_cast<int>(m_latencySum / m_latencyCount) : -1;
+        const qint64 playoutDelay = m_playoutDelayMs;
+        sendReport(fps, lost, now - m_lastStatsTime);
         m_framesReceived = 0;
+        m_framesLost = 0;
+        m_chunksRecovered = 0;
+        m_chunksRequested = 0;
+        m_framesSkipped = 0;
+        m_framesLate = 0;
+        m_latencySum = 0;
+        m_latencyCount = 0;
         m_lastStatsTime = now;
-        
+
         locker.unlock();
-        emit statsUpdated(fps, m_framesLost);
-        m_framesLost = 0;
+        emit statsUpdated(fps, lost, latency);
+        if (recovered > 0 || requested > 0 || skipped > 0 || late > 0) {
+            qDebug() << "[VideoReceiver] 校验分片恢复了" << recovered << "个分片，请求重传"
+                     << requested << "个分片，跳过" << skipped << "帧，错过播放时刻"
+                     << late << "帧，缓冲延迟" << playoutDelay << "ms";
+        }
     }
 }
 
-void VideoReceiver::cleanupOldFrames()
+void VideoReceiver::requestMissingChunks(qint64 now)
 {
-    // 清理早于最后完成帧的缓冲
-    std::vector<uint32_t> toRemove;
-    for (auto& [frameId, buffer] : m_frameBuffers) {
-        if (frameId < m_lastCompletedFrame) {
-            toRemove.push_back(frameId);
+    if (!m_socket) {
+        return;
+    }
+
+    for (FrameSlot& buffer : m_slots) {
+        // 重传要在帧超时前赶到，来不及的不再请求
+        if (buffer.state != FrameSlot::State::Assembling
+            || buffer.nackRounds >= kMaxNackRounds
+            || now - buffer.lastChunkTime < kNackQuietMs
+            || now - buffer.lastNackTime < kNackIntervalMs
+            || now - buffer.firstChunkTime + kNackIntervalMs > VIDEO_FRAME_TIMEOUT_MS
+            || buffer.senderPort == 0) {
+            continue;
+        }
+
+        const std::vector<uint16_t> missing = buffer.missingChunks();
+        if (missing.empty()) {
+            continue;
         }
+
+        const size_t requested = buildNackPacket(buffer.frameId, missing, m_nackPacket);
+        m_socket->writeDatagram(reinterpret_cast<const char*>(m_nackPacket.data()),
+                                static_cast<qint64>(m_nackPacket.size()),
+                                buffer.senderAddress, buffer.senderPort);
+        buffer.lastNackTime = now;
+        ++buffer.nackRounds;
+        m_chunksRequested += static_cast<int>(requested);
     }
-    for (uint32_t id : toRemove) {
-        m_frameBuffers.erase(id);
+}
+
+void VideoReceiver::sendReport(int framesReceived, int framesLost, qint64 intervalMs)
+{
+    if (!m_socket || m_streamerPort == 0) {
+        return;
     }
+
+    VideoReportPacket report;
+    std::memset(&report, 0, sizeof(report));
+    report.magic = VIDEO_REPORT_MAGIC;
+    report.lastFrameId = m_lastCompletedFrame;
+    report.intervalMs = static_cast<uint16_t>(std::min<qint64>(intervalMs, UINT16_MAX));
+    report.framesReceived = static_cast<uint16_t>(std::min(framesReceived, int(UINT16_MAX)));
+    report.framesLost = static_cast<uint16_t>(std::min(framesLost, int(UINT16_MAX)));
+    report.chunksRecovered = static_cast<uint16_t>(std::min(m_chunksRecovered, int(UINT16_MAX)));
+    report.chunksRequested = static_cast<uint16_t>(std::min(m_chunksRequested, int(UINT16_MAX)));
+
+    m_socket->writeDatagram(reinterpret_cast<const char*>(&report), sizeof(report),
+                            m_streamerAddress, m_streamerPort);
 }
 
-bool VideoReceiver::FrameBuffer::isComplete() const
+void VideoReceiver::FrameSlot::reset(uint32_t id, uint16_t chunks, size_t expectedSize)
 {
-    return std::all_of(received.begin(), received.end(), [](bool b) { return b; });
+    // 已知整帧大小时在第一个分片到达时就扩好：按分片长度排布最多比整帧多出一个分片，
+    // 收齐前不再扩容；与分片数明显不符的大小不予理会
+    if (expectedSize > 0 && expectedSize <= kMaxFrameSize
+        && expectedSize <= static_cast<size_t>(chunks) * VIDEO_MAX_CHUNK_SIZE
+        && data.size() < expectedSize + VIDEO_MAX_CHUNK_SIZE) {
+        data.resize(expectedSize + VIDEO_MAX_CHUNK_SIZE);
+    }
+    state = State::Assembling;
+    frameId = id;
+    totalChunks = chunks;
+    receivedCount = 0;
+    stride = 0;
+    tail.clear();
+    receivedBits.assign((chunks + 63) / 64, 0);
+    for (auto& group : parity) {
+        group.clear();
+    }
+    groupSize = 0;
+    lastNackTime = 0;
+    nackRounds = 0;
 }
 
-std::vector<uint8_t> VideoReceiver::FrameBuffer::assemble() const
+bool VideoReceiver::FrameSlot::has(size_t index) const
 {
-    std::vector<uint8_t> result;
-    for (const auto& chunk : chunks) {
-        result.insert(result.end(), chunk.begin(), chunk.end());
+    return (receivedBits[index / 64] >> (index % 64)) & 1;
+}
+
+bool VideoReceiver::FrameSlot::store(size_t index, const uint8_t* payload, size_t size)
+{
+    if (index + 1 == totalChunks) {
+        if (stride != 0 && size > stride) {
+            return false;
+        }
+        tail.assign(payload, payload + size);
+    } else {
+        if (size == 0) {
+            return false;
+        }
+        if (stride == 0) {
+            if (!tail.empty() && tail.size() > size) {
+                return false;
+            }
+            if (size * totalChunks > kMaxFrameSize) {
+                return false;
+            }
+            stride = size;
+            if (data.size() < stride * totalChunks) {
+                data.resize(stride * totalChunks);
+            }
+        } else if (size != stride) {
+            return false;
+        }
+        std::memcpy(data.data() + index * stride, payload, size);
+    }
+
+    receivedBits[index / 64] |= uint64_t(1) << (index % 64);
+    ++receivedCount;
+    return true;
+}
+
+const uint8_t* VideoReceiver::FrameSlot::chunkData(size_t index) const
+{
+    return index + 1 == totalChunks ? tail.data() : data.data() + index * stride;
+}
+
+size_t VideoReceiver::FrameSlot::chunkSize(size_t index) const
+{
+    return index + 1 == totalChunks ? tail.size() : stride;
+}
+
+void VideoReceiver::FrameSlot::finish()
+{
+    if (totalChunks == 1) {
+        frameSize = tail.size();
+        return;
+    }
+
+    // data在确定分片长度时已按totalChunks个分片扩好，末尾分片不超过分片长度
+    const size_t offset = stride * (totalChunks - 1u);
+    std::memcpy(data.data() + offset, tail.data(), tail.size());
+    frameSize = offset + tail.size();
+}
+
+std::vector<uint16_t> VideoReceiver::FrameSlot::missingChunks() const
+{
+    std::vector<uint16_t> missing;
+    for (size_t i = 0; i < totalChunks; ++i) {
+        if (!has(i)) {
+            missing.push_back(static_cast<uint16_t>(i));
+        }
+    }
+    return missing;
+}
+
+void VideoReceiver::FrameSlot::storeParity(uint16_t group, const uint8_t* payload, size_t size)
+{
+    if (size <= sizeof(VideoParityHeader)) {
+        return;
+    }
+
+    VideoParityHeader parityHeader;
+    std::memcpy(&parityHeader, payload, sizeof(parityHeader));
+    if (parityHeader.groupSize == 0) {
+        return;
+    }
+
+    const size_t groups = (totalChunks + parityHeader.groupSize - 1) / parityHeader.groupSize;
+    if (group >= groups || groups * size > kMaxFrameSize) {
+        return;
+    }
+
+    groupSize = parityHeader.groupSize;
+    if (parity.size() < groups) {
+        parity.resize(groups);
+    }
+    parity[group].assign(payload, payload + size);
+}
+
+bool VideoReceiver::FrameSlot::tryRecover(uint16_t group, std::vector<uint8_t>& scratch)
+{
+    if (groupSize == 0 || group >= parity.size() || parity[group].empty()) {
+        return false;
+    }
+
+    const size_t first = static_cast<size_t>(group) * groupSize;
+    const size_t last = std::min<size_t>(first + groupSize, totalChunks);
+    if (first >= last) {
+        return false;
+    }
+
+    size_t missing = last;
+    std::vector<std::pair<const uint8_t*, size_t>> others;
+    for (size_t i = first; i < last; ++i) {
+        if (has(i)) {
+            others.emplace_back(chunkData(i), chunkSize(i));
+        } else if (missing != last) {
+            return false;   // 缺了不止一个，等重传或放弃
+        } else {
+            missing = i;
+        }
+    }
+
+    if (missing == last) {
+        return false;
+    }
+
+    if (!recoverChunkFromParity(parity[group].data(), parity[group].size(),
+                                others, missing, totalChunks, scratch)) {
+        return false;
     }
-    return result;
+    return store(missing, scratch.data(), scratch.size());
 }
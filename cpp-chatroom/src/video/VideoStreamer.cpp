@@ -1,11 +1,73 @@
 #include "video/VideoStreamer.h"
 #include "video/VideoFrame.h"
+#include "video/VideoPacer.h"
 #include "ipmsg.h"
 #include <QDebug>
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <cerrno>
+#endif
+
+namespace
+{
+
+// sendmmsg每批提交的分片数，一帧通常在一两批内发完
+constexpr size_t kSendBatch = 64;
+// 发送缓冲满时等待可写的时间
+constexpr int kSendWaitMs = 5;
+// 一帧的分片连续提交，放大发送缓冲以免突发时被内核丢弃
+constexpr int kSendBufferSize = 1024 * 1024;
+// 默认目标码率，约为30fps下每帧80KB，50KB的帧约在帧间隔的六成内发完
+constexpr qint64 kDefaultBitrate = 20 * 1000 * 1000;
+
+// 画质档位，由好到差；先降画质，再降分辨率，最后降帧率
+struct QualityLevel {
+    int jpegQuality;
+    double scale;
+    int maxFps;
+};
+constexpr QualityLevel kQualityLevels[] = {
+    {80, 1.0, 0},
+    {70, 1.0, 0},
+    {60, 0.75, 0},
+    {50, 0.75, 20},
+    {45, 0.5, 15},
+    {40, 0.5, 10},
+};
+constexpr int kQualityLevelCount = static_cast<int>(sizeof(kQualityLevels) / sizeof(kQualityLevels[0]));
+
+// 丢帧率或需要补救（恢复+重传）的分片比例超过这些值即视为拥塞
+constexpr double kCongestedFrameLoss = 0.05;
+constexpr double kCongestedChunkLoss = 0.10;
+// 分片损失低于此值的周期算作无损
+constexpr double kCleanChunkLoss = 0.02;
+// 连续这么多个无损周期后升一档
+constexpr int kReportsBeforeUpgrade = 3;
+
+// 缓冲只由自己持有时原地复用；发送线程还有作业指向它时换一块新的，旧的随作业释放
+std::vector<uint8_t>& writableBuffer(std::shared_ptr<std::vector<uint8_t>>& buffer)
+{
+    if (!buffer || buffer.use_count() > 1) {
+        buffer = std::make_shared<std::vector<uint8_t>>();
+    }
+    return *buffer;
+}
+
+}
 
 VideoStreamer::VideoStreamer(QObject* parent)
     : QObject(parent)
+    , m_targetBitrate(kDefaultBitrate)
 {
 }
 
@@ -24,12 +86,52 @@ bool VideoStreamer::startStreaming(const QString& targetIp, uint16_t targetPort)
 
     if (!m_socket) {
         m_socket = new QUdpSocket(this);
+        connect(m_socket, &QUdpSocket::readyRead, this, &VideoStreamer::onFeedbackReadyRead);
     }
 
+    // 先绑定以得到套接字描述符，供sendmmsg直接使用
+    if (m_socket->state() != QAbstractSocket::BoundState
+        && !m_socket->bind(QHostAddress(QHostAddress::AnyIPv4), 0)) {
+        qDebug() << "[VideoStreamer] 绑定本地端口失败，改用逐包发送:" << m_socket->errorString();
+    }
+    m_socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, kSendBufferSize);
+
     m_targetAddress = QHostAddress(targetIp);
     m_targetPort = targetPort;
     m_targetIp = targetIp;
     m_frameId = 0;
+    m_streamId = QRandomGenerator::global()->generate();
+    m_chunksRetransmitted = 0;
+    for (SentFrame& frame : m_sentFrames) {
+        frame.valid = false;
+    }
+    m_qualityLevel = 0;
+    m_cleanReports = 0;
+    m_windowFramesSent = 0;
+    m_windowChunksSent = 0;
+    m_frameClock.start();
+    m_nextFrameDueMs = 0;
+
+    // 发送线程只通过原生描述符或加锁的套接字发送，读取反馈仍在本线程
+    m_pacer = new VideoPacer(
+        [this](const std::vector<VideoChunkView>& views) { return sendChunks(views); },
+        [this](uint32_t frameId, int sent, int total) {
+            if (sent == total) {
+                emit frameSent(frameId, sent);
+            } else {
+                emit sendError(QString("帧 %1 部分发送失败 (%2/%3)")
+                               .arg(frameId)
+                               .arg(sent)
+                               .arg(total));
+            }
+        },
+        [this](qint64 bitsPerSecond, int framesDropped) {
+            m_sendRate = bitsPerSecond;
+            emit sendRateUpdated(bitsPerSecond, framesDropped);
+        });
+    m_pacer->setTargetBitrate(m_targetBitrate);
+    m_pacer->start();
+
     m_streaming = true;
 
     qDebug() << "[VideoStreamer] 开始向" << targetIp << ":" << targetPort << "推流";
@@ -48,19 +150,39 @@ void VideoStreamer::stopStreaming()
 
     m_streaming = false;
 
+    // 先停发送线程，它还在使用套接字和重传环中的帧数据
+    if (m_pacer) {
+        m_pacer->stop();
+        delete m_pacer;
+        m_pacer = nullptr;
+    }
+    m_sendRate = 0;
+
     if (m_socket) {
         m_socket->close();
         delete m_socket;
         m_socket = nullptr;
     }
 
+    if (m_chunksRetransmitted > 0) {
+        qDebug() << "[VideoStreamer] 本次推流共重传" << m_chunksRetransmitted << "个分片";
+    }
     qDebug() << "[VideoStreamer] 停止推流";
     emit streamingStopped();
 }
 
-bool VideoStreamer::sendFrame(const std::vector<uint8_t>& jpegData, uint16_t width, uint16_t height)
+void VideoStreamer::setTargetBitrate(qint64 bitsPerSecond)
+{
+    m_targetBitrate = std::max<qint64>(bitsPerSecond, 0);
+    if (m_pacer) {
+        m_pacer->setTargetBitrate(m_targetBitrate);
+    }
+}
+
+bool VideoStreamer::sendFrame(const std::vector<uint8_t>& jpegData, uint16_t width, uint16_t height,
+                              qint64 captureTimeMs)
 {
-    if (!m_streaming || !m_socket) {
+    if (!m_streaming || !m_socket || !m_pacer) {
         return false;
     }
 
@@ -70,20 +192,240 @@ bool VideoStreamer::sendFrame(const std::vector<uint8_t>& jpegData, uint16_t wid
 
     uint32_t frameId = m_frameId++;
 
-    // 将帧拆分为UDP分包
-    auto chunks = splitFrameToChunks(frameId, jpegData, VIDEO_MAX_CHUNK_SIZE);
+    // 分片只描述包头和载荷在原数据中的位置，不复制
+    // 启用纠错时给校验分片的载荷头留出空间，保证校验分片也不超过单包上限
+    const int fecGroupSize = m_fecGroupSize;
+    const int version = m_protocolVersion;
+    const size_t maxChunkSize = fecGroupSize > 0
+        ? VIDEO_MAX_CHUNK_SIZE - sizeof(VideoParityHeader)
+        : VIDEO_MAX_CHUNK_SIZE;
 
-    if (chunks.empty()) {
+    // 帧数据留在重传环中，分片直接指向环里的副本；排入发送线程的作业持有副本的引用，
+    // 槽位被新帧覆盖时仍在排队或发送的分片不受影响
+    SentFrame& sent = m_sentFrames[frameId % kRetransmitFrames];
+    std::vector<uint8_t>& data = writableBuffer(sent.data);
+    data.assign(jpegData.begin(), jpegData.end());
+    sent.meta.frameId = frameId;
+    sent.meta.width = width;
+    sent.meta.height = height;
+    sent.meta.timestamp = static_cast<uint64_t>(captureTimeMs > 0 ? captureTimeMs : QDateTime::currentMSecsSinceEpoch());
+    sent.meta.codec = VIDEO_CODEC_JPEG;
+    sent.meta.streamId = m_streamId;
+    sent.maxChunkSize = maxChunkSize;
+    sent.version = version;
+    sent.valid = true;
+
+    if (splitFrameToChunkViews(sent.meta, data.data(), data.size(),
+                               m_chunkViews, maxChunkSize, version) == 0) {
+        sent.valid = false;
         emit sendError("帧分包失败");
         return false;
     }
 
-    // 发送所有分包
+    appendParityChunks(m_chunkViews, jpegData.size(), static_cast<size_t>(fecGroupSize),
+                       writableBuffer(sent.parity));
+    ++m_windowFramesSent;
+    m_windowChunksSent += static_cast<int>(m_chunkViews.size());
+
+    // 由发送线程按目标码率摊开发出，完成后发出frameSent
+    m_pacer->enqueueFrame(frameId, m_chunkViews, sent.data, sent.parity);
+    return true;
+}
+
+VideoStreamer::EncodeSettings VideoStreamer::encodeSettings() const
+{
+    const QualityLevel& level = kQualityLevels[m_qualityLevel];
+    EncodeSettings settings;
+    settings.jpegQuality = level.jpegQuality;
+    settings.scale = level.scale;
+    settings.maxFps = level.maxFps;
+    return settings;
+}
+
+bool VideoStreamer::shouldSendFrame()
+{
+    const int maxFps = kQualityLevels[m_qualityLevel].maxFps;
+    if (!m_streaming || maxFps <= 0) {
+        return m_streaming;
+    }
+
+    // 按固定节拍放行，摄像头帧间隔的抖动不会让实际帧率低于上限
+    const qint64 now = m_frameClock.elapsed();
+    const qint64 interval = 1000 / maxFps;
+    if (now + interval / 4 < m_nextFrameDueMs) {
+        return false;
+    }
+    m_nextFrameDueMs = (now - m_nextFrameDueMs > interval) ? now + interval : m_nextFrameDueMs + interval;
+    return true;
+}
+
+void VideoStreamer::onFeedbackReadyRead()
+{
+    while (m_socket && m_socket->hasPendingDatagrams()) {
+        QHostAddress sender;
+        qint64 size = 0;
+        {
+            QMutexLocker socketLocker(&m_socketMutex);
+            m_feedback.resize(static_cast<size_t>(qMax<qint64>(m_socket->pendingDatagramSize(), 0)));
+            size = m_socket->readDatagram(reinterpret_cast<char*>(m_feedback.data()),
+                                          static_cast<qint64>(m_feedback.size()), &sender);
+        }
+        if (size <= 0 || !m_streaming || !sender.isEqual(m_targetAddress, QHostAddress::TolerantConversion)) {
+            continue;
+        }
+
+        uint32_t frameId = 0;
+        VideoReportPacket report;
+        if (parseNackPacket(m_feedback.data(), static_cast<size_t>(size), frameId, m_nackIndexes)) {
+            retransmit(frameId, m_nackIndexes);
+        } else if (parseReportPacket(m_feedback.data(), static_cast<size_t>(size), report)) {
+            onReport(report);
+        }
+    }
+}
+
+void VideoStreamer::onReport(const VideoReportPacket& report)
+{
+    const int framesSent = m_windowFramesSent;
+    const int chunksSent = m_windowChunksSent;
+    m_windowFramesSent = 0;
+    m_windowChunksSent = 0;
+
+    const int framesSeen = report.framesReceived + report.framesLost;
+    if (framesSent == 0 || framesSeen == 0) {
+        return;     // 本周期没有可比较的数据
+    }
+
+    const double frameLoss = static_cast<double>(report.framesLost) / framesSeen;
+    const double chunkLoss = chunksSent > 0
+        ? static_cast<double>(report.chunksRecovered + report.chunksRequested) / chunksSent
+        : 0.0;
+    // 整帧一个分片都没到的情况接收端无从统计，用发出与完成的帧数差来补
+    const bool framesMissing = framesSent >= 5 && report.framesReceived * 5 < framesSent * 4;
+
+    const int previous = m_qualityLevel;
+    if (frameLoss > kCongestedFrameLoss || chunkLoss > kCongestedChunkLoss || framesMissing) {
+        m_qualityLevel = std::min(m_qualityLevel + 2, kQualityLevelCount - 1);
+        m_cleanReports = 0;
+    } else if (report.framesLost == 0 && chunkLoss < kCleanChunkLoss) {
+        if (++m_cleanReports >= kReportsBeforeUpgrade) {
+            m_qualityLevel = std::max(m_qualityLevel - 1, 0);
+            m_cleanReports = 0;
+        }
+    } else {
+        m_cleanReports = 0;
+    }
+
+    if (m_qualityLevel != previous) {
+        const QualityLevel& level = kQualityLevels[m_qualityLevel];
+        qDebug() << "[VideoStreamer] 丢帧率" << frameLoss << "分片损失" << chunkLoss
+                 << "，画质调整为" << level.jpegQuality << "缩放" << level.scale << "帧率上限" << level.maxFps;
+        emit encodeSettingsChanged(level.jpegQuality, level.scale, level.maxFps);
+    }
+}
+
+void VideoStreamer::retransmit(uint32_t frameId, const std::vector<uint16_t>& indexes)
+{
+    const SentFrame& sent = m_sentFrames[frameId % kRetransmitFrames];
+    if (!sent.valid || sent.meta.frameId != frameId) {
+        return;     // 已被新帧覆盖
+    }
+
+    // 拆分是确定的，按原分片大小、版本和元数据重新拆分得到与首次发送相同的分片
+    if (splitFrameToChunkViews(sent.meta, sent.data->data(), sent.data->size(),
+                               m_chunkViews, sent.maxChunkSize, sent.version) == 0) {
+        return;
+    }
+
+    m_retransmitViews.clear();
+    for (uint16_t index : indexes) {
+        if (index < m_chunkViews.size()) {
+            m_retransmitViews.push_back(m_chunkViews[index]);
+        }
+    }
+
+    if (m_retransmitViews.empty() || !m_pacer) {
+        return;
+    }
+    m_chunksRetransmitted += static_cast<int>(m_retransmitViews.size());
+    m_pacer->enqueueRetransmit(frameId, m_retransmitViews, sent.data);
+}
+
+int VideoStreamer::sendChunks(const std::vector<VideoChunkView>& views)
+{
+#ifdef Q_OS_LINUX
+    const int fd = static_cast<int>(m_socket->socketDescriptor());
+    if (fd < 0 || m_targetAddress.protocol() != QAbstractSocket::IPv4Protocol) {
+        return sendChunksFallback(views);
+    }
+
+    sockaddr_in target;
+    std::memset(&target, 0, sizeof(target));
+    target.sin_family = AF_INET;
+    target.sin_port = htons(m_targetPort);
+    target.sin_addr.s_addr = htonl(m_targetAddress.toIPv4Address());
+
+    mmsghdr msgs[kSendBatch];
+    iovec iovs[kSendBatch][2];
+
+    size_t next = 0;
+    while (next < views.size()) {
+        const size_t batch = std::min(kSendBatch, views.size() - next);
+        for (size_t i = 0; i < batch; ++i) {
+            const VideoChunkView& view = views[next + i];
+            iovs[i][0].iov_base = const_cast<VideoChunkHeaderV2*>(&view.header);
+            iovs[i][0].iov_len = view.header.headerSize;
+            iovs[i][1].iov_base = const_cast<uint8_t*>(view.payload);
+            iovs[i][1].iov_len = view.payloadSize;
+
+            std::memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_name = &target;
+            msgs[i].msg_hdr.msg_namelen = sizeof(target);
+            msgs[i].msg_hdr.msg_iov = iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        const int ret = ::sendmmsg(fd, msgs, static_cast<unsigned int>(batch), 0);
+        if (ret > 0) {
+            next += static_cast<size_t>(ret);
+            continue;
+        }
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // QUdpSocket是非阻塞的，发送缓冲满时稍等片刻
+            pollfd pfd{fd, POLLOUT, 0};
+            if (::poll(&pfd, 1, kSendWaitMs) > 0) {
+                continue;
+            }
+        }
+
+        qDebug() << "[VideoStreamer] sendmmsg失败:" << std::strerror(errno);
+        break;
+    }
+    return static_cast<int>(next);
+#else
+    return sendChunksFallback(views);
+#endif
+}
+
+int VideoStreamer::sendChunksFallback(const std::vector<VideoChunkView>& views)
+{
+    // 在发送线程调用，QUdpSocket不是线程安全的，与读取反馈互斥
+    QMutexLocker socketLocker(&m_socketMutex);
     int sentCount = 0;
-    for (const auto& chunk : chunks) {
+    for (size_t i = 0; i < views.size(); ++i) {
+        const VideoChunkView& view = views[i];
+        const size_t headerSize = view.header.headerSize;
+        m_datagram.resize(headerSize + view.payloadSize);
+        std::memcpy(m_datagram.data(), &view.header, headerSize);
+        std::memcpy(m_datagram.data() + headerSize, view.payload, view.payloadSize);
+
         qint64 sent = m_socket->writeDatagram(
-            reinterpret_cast<const char*>(chunk.data()),
-            static_cast<qint64>(chunk.size()),
+            reinterpret_cast<const char*>(m_datagram.data()),
+            static_cast<qint64>(m_datagram.size()),
             m_targetAddress,
             m_targetPort
         );
@@ -94,15 +436,5 @@ bool VideoStreamer::sendFrame(const std::vector<uint8_t>& jpegData, uint16_t wid
             ++sentCount;
         }
     }
-
-    if (sentCount == static_cast<int>(chunks.size())) {
-        emit frameSent(frameId, sentCount);
-        return true;
-    } else {
-        emit sendError(QString("帧 %1 部分发送失败 (%2/%3)")
-                       .arg(frameId)
-                       .arg(sentCount)
-                       .arg(chunks.size()));
-        return false;
-    }
+    return sentCount;
 }